@@ -0,0 +1,69 @@
+/* Speed of matmul's blocked, tiled product against the naive triple */
+/* loop, in GFLOP/s, on square Matrices of 256, 512 and 1024 */
+/* Build it with the interpreter and run from the repository root: */
+/*   cc -O2 -std=c99 -Impc bench/matmul.c mpc/mpc.c -o matmul -ledit -lm -pthread */
+/*   ./matmul */
+
+#define main lispy_main
+#include "../utils/utils.c"
+#undef main
+
+/* The product as the definition gives it, one element at a time */
+void naive_mul(double* c, double* a, double* b, int m, int k, int n) {
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            double s = 0;
+            for (int p = 0; p < k; p++) { s += a[(size_t)i * k + p] * b[(size_t)p * n + j]; }
+            c[(size_t)i * n + j] = s;
+        }
+    }
+}
+
+/* Best seconds of "runs" products of "a" and "b", "n" square, into "c" */
+double best_of(void (*mul)(double*, double*, double*, int, int, int),
+        double* c, double* a, double* b, int n, int runs) {
+    double best = 0;
+    for (int r = 0; r < runs; r++) {
+        double t = ltime_clock();
+        mul(c, a, b, n, n, n);
+        t = ltime_clock() - t;
+        if (r == 0 || t < best) { best = t; }
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    ltime_on = 1;
+    lsimd_init();
+
+    printf("%6s %12s %12s %8s\n", "n", "naive", "matmul", "speedup");
+    int sizes[] = { 256, 512, 1024 };
+    for (int s = 0; s < 3; s++) {
+        int n = sizes[s];
+        size_t len = (size_t)n * n;
+        double* a = malloc(len * sizeof(double));
+        double* b = malloc(len * sizeof(double));
+        double* c = malloc(len * sizeof(double));
+        double* d = malloc(len * sizeof(double));
+        for (size_t i = 0; i < len; i++) {
+            a[i] = (double)(i % 7) - 3;
+            b[i] = (double)(i % 5) * 0.5;
+        }
+
+        int runs = n < 1024 ? 5 : 2;
+        double naive = best_of(naive_mul, d, a, b, n, runs);
+        double tiled = best_of(lmat_mul, c, a, b, n, runs);
+
+        /* Each element adds its steps in the same order either way */
+        if (memcmp(c, d, len * sizeof(double)) != 0) {
+            printf("%6i products differ\n", n);
+            return 1;
+        }
+
+        double flops = 2.0 * n * n * n;
+        printf("%6i %8.2f GF/s %8.2f GF/s %7.1fx\n", n,
+                flops / naive * 1e-9, flops / tiled * 1e-9, naive / tiled);
+        free(a); free(b); free(c); free(d);
+    }
+    return 0;
+}
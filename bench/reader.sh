@@ -0,0 +1,43 @@
+#!/bin/sh
+# Time reading a large generated file with the hand-written reader and
+# with the mpc one, from the seconds each interpreter reports reading
+# Run from the repository root, with an interpreter of each kind and the
+# size of the file in MB (default 5):
+#   cc -std=c99 -Wall -ledit -Impc utils/utils.c mpc/mpc.c -o utils-hand -lm -pthread
+#   cc -std=c99 -Wall -ledit -Impc -DLISPY_MPC_READER utils/utils.c mpc/mpc.c -o utils-mpc -lm -pthread
+#   sh bench/reader.sh ./utils-hand ./utils-mpc [MB]
+
+hand=$1
+mpc=$2
+mb=${3:-5}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+file=$dir/data.lspy
+
+# Rows of data with every kind of form the reader knows, one to a line
+awk -v bytes=$((mb * 1024 * 1024)) 'BEGIN {
+    for (i = 0; size < bytes; i++) {
+        line = sprintf("(def {r%d} {%d -%d %d.%d \"row %d\\n\" sym%d (a b {c %d}) {}}) ; row %d", \
+            i, i, i * 7, i, i % 100, i, i % 50, i, i)
+        print line
+        size += length(line) + 1
+    }
+}' > "$file"
+echo "$(wc -c < "$file") bytes, $(wc -l < "$file") lines"
+
+# The reading seconds --time gives, the best of three runs, on one thread
+read_time() {
+    best=""
+    for run in 1 2 3; do
+        t=$("$1" --no-cache --time --parse-threads 1 "$file" 2>&1 >/dev/null |
+            awk '/^total: read/ { sub(/s$/, "", $3); print $3 }')
+        best=$(echo "$t $best" | awk '{ t = $1; if ($2 != "" && $2 < t) t = $2; print t }')
+    done
+    echo "$best"
+}
+
+h=$(read_time "$hand")
+m=$(read_time "$mpc")
+echo "hand-written reader: ${h}s"
+echo "mpc reader:          ${m}s"
+echo "$h $m $mb" | awk '{ printf "%.1fx faster, %.0f MB/s against %.1f MB/s\n", $2 / $1, $3 / $1, $3 / $2 }'
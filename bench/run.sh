@@ -0,0 +1,32 @@
+#!/bin/sh
+# Time each Lispy benchmark under each interpreter given, taking the
+# best of $RUNS runs (default 5), in seconds of wall time
+# Run from the repository root, with the interpreters to compare:
+#   sh bench/run.sh ./utils/utils [other interpreters...] [-- bench files...]
+
+lispys=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do lispys="$lispys $1"; shift; done
+[ "$1" = "--" ] && shift
+files="$*"
+[ -n "$files" ] || files=$(ls bench/*.lspy)
+[ -n "$lispys" ] || lispys=./utils/utils
+
+now() { date +%s.%N; }
+
+printf '%-24s' "bench"
+for l in $lispys; do printf ' %12s' "$(basename "$(dirname "$l")")/$(basename "$l")"; done
+echo
+for f in $files; do
+    printf '%-24s' "$(basename "$f" .lspy)"
+    for l in $lispys; do
+        best=""
+        for run in $(seq "${RUNS:-5}"); do
+            t0=$(now)
+            "$l" "$f" > /dev/null 2>&1
+            t1=$(now)
+            best=$(echo "$t0 $t1 $best" | awk '{ t = $2 - $1; if ($3 != "" && $3 < t) t = $3; printf "%.3f", t }')
+        done
+        printf ' %12s' "$best"
+    done
+    echo
+done
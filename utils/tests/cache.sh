@@ -0,0 +1,45 @@
+#!/bin/sh
+# The form cache must never write over a file that is not a cache
+# Run from the repository root:
+#   sh utils/tests/cache.sh [./utils/utils]
+
+lispy=$(cd "$(dirname "${1:-./utils/utils}")" && pwd)/$(basename "${1:-./utils/utils}")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+fail=0
+
+check() {
+    if [ "$2" = "$3" ]; then echo "ok $1"; else echo "FAIL $1: got '$2', want '$3'"; fail=1; fi
+}
+
+# A file not named ".lspy" is not cached, whatever is beside it
+echo '(print "notes")' > notes
+echo 'IMPORTANT USER DATA' > notesc
+check "other run" "$("$lispy" notes)" '"notes" '
+check "other kept" "$(cat notesc)" 'IMPORTANT USER DATA'
+
+# Nor is a file beside a ".lspy" file replaced unless it is a cache
+echo '(print "prog")' > prog.lspy
+echo 'IMPORTANT USER DATA' > prog.lspyc
+check "source run" "$("$lispy" prog.lspy)" '"prog" '
+check "source kept" "$(cat prog.lspyc)" 'IMPORTANT USER DATA'
+
+# Several files are read ahead together, and cached the same way
+check "both run" "$("$lispy" notes prog.lspy)" '"notes" 
+"prog" '
+check "both kept" "$(cat notesc prog.lspyc)" 'IMPORTANT USER DATA
+IMPORTANT USER DATA'
+
+# A ".lspy" file with nothing beside it is cached, and runs the same from it
+echo '(print "good")' > good.lspy
+check "cached run" "$("$lispy" good.lspy)" '"good" '
+check "cache written" "$(head -c 5 good.lspyc)" 'LSPYC'
+check "cache run" "$("$lispy" good.lspy)" '"good" '
+
+# A cache is replaced once the source changes
+echo '(print "better")' > good.lspy
+check "changed run" "$("$lispy" good.lspy)" '"better" '
+check "cache rewritten" "$("$lispy" good.lspy)" '"better" '
+
+exit $fail
@@ -1,10 +1,35 @@
+/* For clock_gettime, fstat and getpid */
+#define _POSIX_C_SOURCE 200809L
+
 #include "mpc.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/* Vector kernels using AVX2 are built for x86-64 with GCC or Clang, */
+/* where a long fills a 64-bit lane, and picked at run time. */
+/* Compile with -DLISPY_NO_SIMD to leave them out. */
+#if !defined(LISPY_NO_SIMD) && defined(__GNUC__) && \
+    defined(__x86_64__) && LONG_MAX == 0x7fffffffffffffffL
+#define LSIMD_AVX2
+#include <immintrin.h>
+#endif
+
+/* Large files are read on a pool of threads, unless compiled with */
+/* -DLISPY_NO_THREADS */
+#ifndef LISPY_NO_THREADS
+#define LTHREADS
+#include <pthread.h>
+#endif
 
 #include <editline/readline.h>
 
@@ -12,40 +37,389 @@ struct lval;
 typedef struct lval lval;
 struct lenv;
 typedef struct lenv lenv;
+struct lsym;
+typedef struct lsym lsym;
+struct lscope;
+typedef struct lscope lscope;
+struct lcode;
+typedef struct lcode lcode;
+struct lvec;
+typedef struct lvec lvec;
+struct lhamt;
+typedef struct lhamt lhamt;
+struct lmemo;
+typedef struct lmemo lmemo;
 
-typedef lval* (*lbuiltin)(lenv*, lval*);
+/* Builtins borrow their "argc" arguments, which the caller deletes */
+typedef lval* (*lbuiltin)(lenv*, int, lval**);
 
 /* Declare New lval Struct */
 struct lval {
     int type;
-    long num;
-    double dnum;
-    /* Error and Symbol and String types have some string data */
-    char* err;
-    char* sym;
-    char* str;
-    /* Function have pointer */
-    lbuiltin builtin;
-    lenv* env;
-    lval* formals;
-    lval* body;
-    /* Count and Pointer to a list of "lval*" */
-    int count;
-    struct lval** cell;
+    /* Number of owners sharing this "lval" */
+    int rc;
+    /* Only the fields of the current type are stored */
+    union {
+        /* Numbers too large to be stored in the pointer itself */
+        long num;
+        double dnum;
+        /* Error and String types have some string data */
+        char* err;
+        char* str;
+        /* Symbols that refer to a slot in a lambda's call frame */
+        struct {
+            lsym* sym;
+            unsigned long scope;
+            int slot;
+        } local;
+        /* Function have pointer */
+        /* Builtins made by memo also have the cache of their calls */
+        struct {
+            lbuiltin builtin;
+            lenv* env;
+            lval* formals;
+            lval* body;
+            lmemo* memo;
+        } fun;
+        /* Count, Capacity and Pointer to a list of "lval*" */
+        /* If "vec" is set the cells are a view into that shared buffer */
+        struct {
+            int count;
+            int cap;
+            struct lval** cell;
+            lvec* vec;
+        } list;
+        /* Count and packed data of a Vector of Numbers, or of */
+        /* Doubles if "dbl" is set */
+        struct {
+            int count;
+            int dbl;
+            void* data;
+        } pack;
+        /* Shape and row-major elements of a Matrix of Doubles */
+        struct {
+            int rows;
+            int cols;
+            double* data;
+        } mat;
+        /* Count, Capacity and slots of an Array */
+        struct {
+            int count;
+            int cap;
+            struct lval** slot;
+        } arr;
+        /* Root and number of keys of a Map */
+        struct {
+            lhamt* root;
+            int count;
+        } map;
+    } u;
 };
 
 /* Declare New lenv Struct */
 struct lenv {
     lenv* par;
     int count;
-    char** syms;
+    int cap;
+    lsym** syms;
     lval** vals;
+    /* Open-addressing hash of positions in syms/vals (0 is empty) */
+    /* Only built once an environment outgrows a plain linear search */
+    int* index;
+    int index_cap;
+    /* Lambda this is a frame of, whose slot names "syms" starts out as */
+    lscope* scope;
+};
+
+/* Declare New lscope Struct, the slot layout of a lambda's frames */
+struct lscope {
+    int rc;
+    /* Unique id the slot Symbols of the lambda body refer to */
+    unsigned long id;
+    /* Body compiled on first call */
+    lcode* code;
+    /* Formal at each position of the formals list maps to a slot */
+    int nformals;
+    int* slot_of;
+    /* One slot per distinct formal name */
+    int count;
+    lsym* syms[];
+};
+
+/* Declare New lvec Struct, a buffer of cells shared by list views */
+/* Cells "lo" up to "hi" are in use and owned by the buffer, the rest */
+/* is room for joins to grow the list at either end in place */
+struct lvec {
+    int rc;
+    int lo;
+    int hi;
+    int cap;
+    lval* cell[];
+};
+
+/* Declare New lhamt Struct, a node of the trie behind Maps */
+/* Each five bits of a key's hash pick one of 32 positions in a node, */
+/* and "bitmap" marks the positions in use. An entry there holds either */
+/* a key and value or, in "sub", the node for the next five bits. Once */
+/* the hash runs out a node just lists the keys sharing it. Nodes are */
+/* shared between versions of a Map and never changed. */
+typedef struct lhent {
+    unsigned long hash;
+    struct lval* key;
+    struct lval* val;
+    lhamt* sub;
+} lhent;
+
+struct lhamt {
+    int rc;
+    uint32_t bitmap;
+    int count;
+    lhent ent[];
+};
+
+#define LHAMT_BITS 5
+#define LHAMT_HASH_BITS ((int)sizeof(unsigned long) * CHAR_BIT)
+
+/* A memo function keeps the results of its latest calls in a hash table */
+/* keyed on the arguments, with the calls also on a list from most to */
+/* least recently used, so the oldest can be forgotten once it is full. */
+typedef struct lmemo_ent lmemo_ent;
+
+struct lmemo_ent {
+    unsigned long hash;
+    lmemo_ent* next;
+    lmemo_ent* newer;
+    lmemo_ent* older;
+    struct lval* val;
+    int argc;
+    struct lval* argv[];
+};
+
+struct lmemo {
+    int rc;
+    struct lval* f;
+    int cap;
+    int count;
+    int nbuckets;
+    lmemo_ent** buckets;
+    lmemo_ent* newest;
+    lmemo_ent* oldest;
+    long hits;
+    long misses;
+    long evictions;
+};
+
+#define LMEMO_CAP 4096
+
+/* Environments with more bindings than this get a hash index */
+#define LENV_INDEX_MIN 16
+
+/* Declare New lsym Struct, one per distinct symbol name */
+struct lsym {
+    unsigned long hash;
+    /* Number of bindings in live lambda frames */
+    int binds;
+    /* Special form named by the symbol, plus one, or zero */
+    int form;
+    char name[];
 };
 
 /* Construct Enumeration of Possible lval Types */
-enum { LVAL_ERR, LVAL_NUM, LVAL_DNUM, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR};
+enum { LVAL_ERR, LVAL_NUM, LVAL_DNUM, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR,
+       LVAL_VEC, LVAL_MAT, LVAL_ARRAY, LVAL_MAP};
+
+/* Numbers are stored directly in the "lval*" when they fit, */
+/* tagged in the two low bits that are always zero for a real pointer */
+/* Symbols are always stored as their interned "lsym*" */
+#define LVAL_IMM_NUM  1
+#define LVAL_IMM_DNUM 2
+#define LVAL_IMM_SYM  3
+#define LVAL_IMM(v) ((uintptr_t)(v) & 3)
+
+/* Doubles can only be immediate if they are as wide as a pointer */
+#define LVAL_IMM_DNUM_OK (sizeof(double) == sizeof(uintptr_t))
+
+/* Decode an immediate double */
+static inline double lval_imm_dnum(lval* v) {
+    uintptr_t bits = (uintptr_t)v & ~(uintptr_t)3;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+/* Type of each kind of immediate */
+static const int lval_imm_type[4] = { 0, LVAL_NUM, LVAL_DNUM, LVAL_SYM };
+
+/* Accessors working on both immediate and allocated "lval"s */
+#define LTYPE(v) (LVAL_IMM(v) ? lval_imm_type[LVAL_IMM(v)] : (v)->type)
+#define LNUM(v) (LVAL_IMM(v) == LVAL_IMM_NUM ? \
+        (long)((intptr_t)(v) >> 2) : (v)->u.num)
+#define LDNUM(v) (LVAL_IMM(v) == LVAL_IMM_DNUM ? \
+        lval_imm_dnum(v) : (v)->u.dnum)
+
+/* Accessors for "lval"s that are always allocated */
+#define LERR(v) ((v)->u.err)
+#define LSYMID(v) (LVAL_IMM(v) ? \
+        (lsym*)((uintptr_t)(v) & ~(uintptr_t)3) : (v)->u.local.sym)
+#define LSYM(v) (LSYMID(v)->name)
+#define LSTR(v) ((v)->u.str)
+#define LBUILTIN(v) ((v)->u.fun.builtin)
+#define LENV(v) ((v)->u.fun.env)
+#define LFORMALS(v) ((v)->u.fun.formals)
+#define LBODY(v) ((v)->u.fun.body)
+#define LMEMO(v) ((v)->u.fun.memo)
+#define LCOUNT(v) ((v)->u.list.count)
+#define LCAP(v) ((v)->u.list.cap)
+#define LCELL(v) ((v)->u.list.cell)
+#define LVEC(v) ((v)->u.list.vec)
+#define LVCOUNT(v) ((v)->u.pack.count)
+#define LVDBL(v) ((v)->u.pack.dbl)
+#define LVNUMS(v) ((long*)(v)->u.pack.data)
+#define LVDNUMS(v) ((double*)(v)->u.pack.data)
+#define LMROWS(v) ((v)->u.mat.rows)
+#define LMCOLS(v) ((v)->u.mat.cols)
+#define LMDATA(v) ((v)->u.mat.data)
+#define LACOUNT(v) ((v)->u.arr.count)
+#define LACAP(v) ((v)->u.arr.cap)
+#define LASLOT(v) ((v)->u.arr.slot)
+#define LHROOT(v) ((v)->u.map.root)
+#define LHCOUNT(v) ((v)->u.map.count)
+
+/* Pool Allocator */
+/* lvals, lenvs and pointer arrays of power-of-two capacity are */
+/* recycled through per-thread free lists instead of malloc/free. */
+/* Compile with -DLISPY_NO_POOL to use plain malloc (ASan, valgrind). */
+typedef struct lpool_item { struct lpool_item* next; } lpool_item;
+
+/* Bytes carved from malloc at once when a free list runs dry */
+#define LPOOL_CHUNK 65536
+/* Pointer arrays up to 2^(LPOOL_CLASSES-1) slots are pooled */
+#define LPOOL_CLASSES 14
+
+static __thread lpool_item* lpool_vals;
+static __thread lpool_item* lpool_envs;
+static __thread lpool_item* lpool_arrays[LPOOL_CLASSES];
+
+#if defined(LTHREADS) && !defined(LISPY_NO_POOL)
+/* Items go back on the free lists of the thread freeing them, so the */
+/* main thread gathers the items threads reading for it made. It leaves */
+/* whole lists in a shared stash now and then, and a thread whose list */
+/* runs dry takes one from there before cutting up fresh memory. */
+#define LPOOL_STASH 64
+static pthread_mutex_t lpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static lpool_item* lpool_stash[LPOOL_CLASSES + 2][LPOOL_STASH];
+static int lpool_stashed[LPOOL_CLASSES + 2];
+
+/* Place in the stash of a free list of this thread */
+static int lpool_index(lpool_item** list) {
+    if (list == &lpool_vals) { return 0; }
+    if (list == &lpool_envs) { return 1; }
+    return 2 + (int)(list - lpool_arrays);
+}
+
+/* Take a list from the stash for an empty free list */
+static void lpool_take(lpool_item** list) {
+    int k = lpool_index(list);
+    pthread_mutex_lock(&lpool_lock);
+    if (lpool_stashed[k]) { *list = lpool_stash[k][--lpool_stashed[k]]; }
+    pthread_mutex_unlock(&lpool_lock);
+}
+
+/* Leave the free lists of this thread in the stash */
+void lpool_give(void) {
+    pthread_mutex_lock(&lpool_lock);
+    for (int k = 0; k < LPOOL_CLASSES + 2; k++) {
+        lpool_item** list = k == 0 ? &lpool_vals : k == 1 ? &lpool_envs
+            : &lpool_arrays[k - 2];
+        if (*list && lpool_stashed[k] < LPOOL_STASH) {
+            lpool_stash[k][lpool_stashed[k]++] = *list;
+            *list = NULL;
+        }
+    }
+    pthread_mutex_unlock(&lpool_lock);
+}
+#else
+static inline void lpool_take(lpool_item** list) {}
+void lpool_give(void) {}
+#endif
+
+/* Take an item of "size" bytes from a free list */
+static void* lpool_get(lpool_item** list, size_t size) {
+#ifdef LISPY_NO_POOL
+    return malloc(size);
+#else
+    if (!*list) { lpool_take(list); }
+    if (!*list) {
+        /* Refill by cutting a fresh chunk into items */
+        size_t n = LPOOL_CHUNK / size;
+        if (n < 8) { n = 8; }
+        char* chunk = malloc(size * n);
+        for (size_t i = 0; i < n; i++) {
+            lpool_item* it = (lpool_item*)(chunk + i * size);
+            it->next = *list;
+            *list = it;
+        }
+    }
+    lpool_item* it = *list;
+    *list = it->next;
+    return it;
+#endif
+}
+
+/* Give an item back to a free list */
+static void lpool_put(lpool_item** list, void* p) {
+#ifdef LISPY_NO_POOL
+    free(p);
+#else
+    lpool_item* it = p;
+    it->next = *list;
+    *list = it;
+#endif
+}
+
+/* Size class of a power-of-two capacity */
+static int lpool_class(int cap) {
+    int k = 0;
+    while ((1 << k) < cap) { k++; }
+    return k;
+}
+
+/* Allocate an array of "cap" pointers, "cap" being a power of two */
+void** lpool_array(int cap) {
+    if (cap == 0) { return NULL; }
+    int k = lpool_class(cap);
+    if (k >= LPOOL_CLASSES) { return malloc(sizeof(void*) * cap); }
+    return lpool_get(&lpool_arrays[k], sizeof(void*) << k);
+}
+
+/* Free an array of "cap" pointers */
+void lpool_array_del(void** a, int cap) {
+    if (!a) { return; }
+    int k = lpool_class(cap);
+    if (k >= LPOOL_CLASSES) { free(a); return; }
+    lpool_put(&lpool_arrays[k], a);
+}
+
+/* Grow an array of "cap" pointers holding "count" items to the next capacity */
+void** lpool_array_grow(void** a, int count, int* cap) {
+    int ncap = *cap ? *cap * 2 : 1;
+    void** n = lpool_array(ncap);
+    if (count) { memcpy(n, a, sizeof(void*) * count); }
+    lpool_array_del(a, *cap);
+    *cap = ncap;
+    return n;
+}
+
+/* Smallest power-of-two capacity holding "count" items */
+int lpool_cap(int count) {
+    return count ? 1 << lpool_class(count) : 0;
+}
+
+#define lval_alloc() ((lval*)lpool_get(&lpool_vals, sizeof(lval)))
+#define lval_free(v) lpool_put(&lpool_vals, (v))
 
 /* Parsers */
+#ifdef LISPY_MPC_READER
 mpc_parser_t* Number;
 mpc_parser_t* Dnumber;
 mpc_parser_t* Symbol;
@@ -55,40 +429,57 @@ mpc_parser_t* Sexpr;
 mpc_parser_t* Qexpr;
 mpc_parser_t* Expr;
 mpc_parser_t* Lispy;
+#endif
 
 /* Construct a pointer to a new Number lval */
 lval* lval_num(long x) {
-    lval* v = malloc(sizeof(lval));
+    /* Store it in the pointer if it survives the shift */
+    intptr_t imm = (intptr_t)((uintptr_t)x << 2);
+    if ((imm >> 2) == x) {
+        return (lval*)(imm | LVAL_IMM_NUM);
+    }
+    lval* v = lval_alloc();
     v->type = LVAL_NUM;
-    v->num = x;
+    v->rc = 1;
+    v->u.num = x;
     return v;
 }
 
 /* Construct a pointer to a new Dnumber lval */
 lval* lval_dnum(double x) {
-    lval* v = malloc(sizeof(lval));
+    /* Store it in the pointer if the low bits of the mantissa are zero */
+    if (LVAL_IMM_DNUM_OK) {
+        uintptr_t bits = 0;
+        memcpy(&bits, &x, sizeof(x));
+        if ((bits & 3) == 0) {
+            return (lval*)(bits | LVAL_IMM_DNUM);
+        }
+    }
+    lval* v = lval_alloc();
     v->type = LVAL_DNUM;
-    v->dnum = x;
+    v->rc = 1;
+    v->u.dnum = x;
     return v;
 }
 
 /* Construct a pointer to a new Error lval */
 lval* lval_err(char* m, ...) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_ERR;
+    v->rc = 1;
     
     /* Create a va list and initialize it */
     va_list va;
     va_start(va, m);
     
     /* Allocate 512 bytes of space */
-    v->err = malloc(sizeof(char) * 512);
+    LERR(v) = malloc(sizeof(char) * 512);
     
     /* printf the error string with a maximum of 511 characters */
-    vsnprintf(v->err, 511, m, va);
+    vsnprintf(LERR(v), 511, m, va);
     
     /* Reallocate to number of bytes actually used */
-    v->err = realloc(v->err, sizeof(char) * (strlen(v->err) + 1));
+    LERR(v) = realloc(LERR(v), sizeof(char) * (strlen(LERR(v)) + 1));
     
     /* Cleanup our va list */
     va_end(va);
@@ -96,132 +487,380 @@ lval* lval_err(char* m, ...) {
     return v;
 }
 
+/* Symbol Table */
+static lsym** lsym_table;
+static int lsym_count;
+static int lsym_cap;
+
+/* Hash a symbol name */
+unsigned long lsym_hash(const char* s) {
+    unsigned long h = 5381;
+    while (*s) { h = h * 33 + (unsigned char)*s++; }
+    return h;
+}
+
+/* Find the "lsym" with hash "h" for the "n" characters at "s" */
+lsym* lsym_insert(const char* s, int n, unsigned long h) {
+    /* Keep the table at most half full */
+    if (lsym_count * 2 >= lsym_cap) {
+        int cap = lsym_cap ? lsym_cap * 2 : 256;
+        lsym** table = calloc(cap, sizeof(lsym*));
+        for (int i = 0; i < lsym_cap; i++) {
+            if (!lsym_table[i]) { continue; }
+            int j = lsym_table[i]->hash & (cap - 1);
+            while (table[j]) { j = (j + 1) & (cap - 1); }
+            table[j] = lsym_table[i];
+        }
+        free(lsym_table);
+        lsym_table = table;
+        lsym_cap = cap;
+    }
+    
+    /* Probe until the name or an empty slot is found */
+    int i = h & (lsym_cap - 1);
+    while (lsym_table[i]) {
+        lsym* y = lsym_table[i];
+        if (y->hash == h && strncmp(y->name, s, n) == 0 && !y->name[n]) {
+            return y;
+        }
+        i = (i + 1) & (lsym_cap - 1);
+    }
+    
+    /* Not found so create it */
+    lsym* y = malloc(sizeof(lsym) + n + 1);
+    y->hash = h;
+    y->binds = 0;
+    y->form = 0;
+    memcpy(y->name, s, n);
+    y->name[n] = '\0';
+    lsym_table[i] = y;
+    lsym_count++;
+    return y;
+}
+
+#ifdef LTHREADS
+/* Threads reading files add names too, so the table is locked. Each */
+/* thread remembers the symbols it found last to seldom need the lock. */
+#define LSYM_CACHE 1024
+static pthread_mutex_t lsym_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread lsym* lsym_cache[LSYM_CACHE];
+#endif
+
+/* Find the unique "lsym" for the "n" characters of a name at "s", */
+/* adding it if it is new */
+lsym* lsym_intern_n(const char* s, int n) {
+    unsigned long h = 5381;
+    for (int k = 0; k < n; k++) { h = h * 33 + (unsigned char)s[k]; }
+#ifdef LTHREADS
+    lsym** c = &lsym_cache[h & (LSYM_CACHE - 1)];
+    lsym* y = *c;
+    if (y && y->hash == h && strncmp(y->name, s, n) == 0 && !y->name[n]) {
+        return y;
+    }
+    pthread_mutex_lock(&lsym_lock);
+    y = lsym_insert(s, n, h);
+    pthread_mutex_unlock(&lsym_lock);
+    return *c = y;
+#else
+    return lsym_insert(s, n, h);
+#endif
+}
+
+/* Find the unique "lsym" for a name, adding it if it is new */
+lsym* lsym_intern(const char* s) {
+    return lsym_intern_n(s, strlen(s));
+}
+
+/* Interned symbols the interpreter looks for itself */
+lsym* lsym_amp;
+
 /* Construct a pointer to a new Symbol lval */
 lval* lval_sym(char* s) {
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
-    return v;
+    return (lval*)((uintptr_t)lsym_intern(s) | LVAL_IMM_SYM);
 }
 
 /* Construct a pointer to a new String lval */
 lval* lval_str(char* s) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
-    strcpy(v->str, s);
+    v->rc = 1;
+    LSTR(v) = malloc(strlen(s) + 1);
+    strcpy(LSTR(v), s);
     return v;
 }
 
 /* Construct a pointer to a new Function lval */
 lval* lval_fun(lbuiltin x) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_FUN;
-    v->builtin = x;
-    v->env = NULL;
-    v->formals = NULL;
-    v->body = NULL;
+    v->rc = 1;
+    LBUILTIN(v) = x;
+    LENV(v) = NULL;
+    LFORMALS(v) = NULL;
+    LBODY(v) = NULL;
+    LMEMO(v) = NULL;
+    return v;
+}
+
+/* Find the slot of a symbol in an "lscope", or -1 */
+int lscope_slot(lscope* s, lsym* k) {
+    for (int i = 0; i < s->count; i++) {
+        if (s->syms[i] == k) { return i; }
+    }
+    return -1;
+}
+
+/* Construct a pointer to a new "lscope" laying out some formals */
+lscope* lscope_new(lval* formals) {
+    static unsigned long ids = 0;
+    lscope* s = malloc(sizeof(lscope) + sizeof(lsym*) * LCOUNT(formals));
+    s->rc = 1;
+    s->id = ++ids;
+    s->code = NULL;
+    s->count = 0;
+    s->nformals = LCOUNT(formals);
+    s->slot_of = malloc(sizeof(int) * (s->nformals + 1));
+    
+    /* Give each distinct name a slot, '&' does not get one */
+    for (int i = 0; i < s->nformals; i++) {
+        lsym* k = LSYMID(LCELL(formals)[i]);
+        if (k == lsym_amp) { s->slot_of[i] = -1; continue; }
+        int slot = lscope_slot(s, k);
+        if (slot < 0) { slot = s->count++; s->syms[slot] = k; }
+        s->slot_of[i] = slot;
+    }
+    return s;
+}
+
+void lcode_del(lcode*);
+
+/* Delete an "lscope" once nothing uses it */
+void lscope_del(lscope* s) {
+    if (--s->rc > 0) { return; }
+    if (s->code) { lcode_del(s->code); }
+    free(s->slot_of);
+    free(s);
+}
+
+/* Construct a pointer to a Symbol lval bound to a slot of "s" */
+lval* lval_local(lsym* k, lscope* s, int slot) {
+    lval* v = lval_alloc();
+    v->type = LVAL_SYM;
+    v->rc = 1;
+    v->u.local.sym = k;
+    v->u.local.scope = s->id;
+    v->u.local.slot = slot;
     return v;
 }
 
 lenv* lenv_new(void);
+lenv* lenv_frame(lscope*);
+lval* lval_resolve(lval*, lscope*);
 
 /* Construct a pointer to a new Lambda lval */
 lval* lval_lambda(lval* formals, lval* body) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_FUN;
+    v->rc = 1;
     
     /* Set Builtin to Null */
-    v->builtin = NULL;
+    LBUILTIN(v) = NULL;
     
-    /* Build new enviroment */
-    v->env = lenv_new();
+    /* Build new enviroment laid out by the formals */
+    lscope* s = lscope_new(formals);
+    LENV(v) = lenv_frame(s);
     
-    /* Set Formals and Body */
-    v->formals = formals;
-    v->body = body;
+    /* Set Formals and Body, pointing the body at the frame slots */
+    LFORMALS(v) = formals;
+    LBODY(v) = lval_resolve(body, s);
+    lscope_del(s);
     return v;
 }
 
 /* Construct a pointer to a new empty Sexpr lval */
 lval* lval_sexpr(void) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_SEXPR;
-    v->count = 0;
-    v->cell = NULL;
+    v->rc = 1;
+    LCOUNT(v) = 0;
+    LCAP(v) = 0;
+    LCELL(v) = NULL;
+    LVEC(v) = NULL;
     return v;
 }
 
 /* Construct a pointer to a new empty Qexpr lval */
 lval* lval_qexpr(void) {
-    lval* v = malloc(sizeof(lval));
+    lval* v = lval_alloc();
     v->type = LVAL_QEXPR;
-    v->count = 0;
-    v->cell = NULL;
+    v->rc = 1;
+    LCOUNT(v) = 0;
+    LCAP(v) = 0;
+    LCELL(v) = NULL;
+    LVEC(v) = NULL;
+    return v;
+}
+
+/* Construct a pointer to a new Vector of "count" uninitialised */
+/* Numbers, or Doubles if "dbl" is set */
+lval* lval_vec(int count, int dbl) {
+    lval* v = lval_alloc();
+    v->type = LVAL_VEC;
+    v->rc = 1;
+    LVCOUNT(v) = count;
+    LVDBL(v) = dbl;
+    /* Keep at least one element so broadcasting may always read it */
+    v->u.pack.data = malloc((count ? count : 1) *
+            (dbl ? sizeof(double) : sizeof(long)));
+    return v;
+}
+
+/* Construct a pointer to a new Matrix of zeros */
+lval* lval_mat(int rows, int cols) {
+    lval* v = lval_alloc();
+    v->type = LVAL_MAT;
+    v->rc = 1;
+    LMROWS(v) = rows;
+    LMCOLS(v) = cols;
+    LMDATA(v) = calloc((size_t)rows * cols + 1, sizeof(double));
     return v;
 }
 
 /* Construct a pointer to a new empty lenv */
 lenv* lenv_new(void) {
-    lenv* e = malloc(sizeof(lenv));
+    lenv* e = lpool_get(&lpool_envs, sizeof(lenv));
     e->par = NULL;
     e->count = 0;
+    e->cap = 0;
     e->syms = NULL;
     e->vals = NULL;
+    e->index = NULL;
+    e->index_cap = 0;
+    e->scope = NULL;
+    return e;
+}
+
+/* Construct a pointer to a new call frame, with every slot unbound */
+lenv* lenv_frame(lscope* s) {
+    lenv* e = lenv_new();
+    e->scope = s;
+    s->rc++;
+    e->count = s->count;
+    e->cap = lpool_cap(s->count);
+    e->vals = (lval**)lpool_array(e->cap);
+    
+    /* The slot names are shared with the scope until "=" adds more */
+    e->syms = s->syms;
+    for (int i = 0; i < e->count; i++) {
+        e->vals[i] = NULL;
+        e->syms[i]->binds++;
+    }
     return e;
 }
 
 void lenv_del(lenv*);
+void lvec_del(lvec*);
+void lhamt_del(lhamt*);
+void lmemo_del(lmemo*);
+
+/* Share an "lval" by adding another owner */
+lval* lval_ref(lval* v) {
+    if (!LVAL_IMM(v)) { v->rc++; }
+    return v;
+}
+
+/* Construct a pointer to a new Array of "count" slots holding "x" */
+lval* lval_array(int count, lval* x) {
+    lval* v = lval_alloc();
+    v->type = LVAL_ARRAY;
+    v->rc = 1;
+    LACOUNT(v) = count;
+    LACAP(v) = lpool_cap(count);
+    LASLOT(v) = (lval**)lpool_array(LACAP(v));
+    for (int i = 0; i < count; i++) { LASLOT(v)[i] = lval_ref(x); }
+    return v;
+}
 
 /* Delete an "lval" */
 void lval_del(lval* v) {
     
+    /* Immediates own nothing */
+    if (LVAL_IMM(v)) { return; }
+    
+    /* Only the last owner really frees the "lval" */
+    if (--v->rc > 0) { return; }
+    
     switch (v->type) {
         /* Do nothing special for number type */
         case LVAL_NUM: break;
         case LVAL_DNUM: break;
         
-        /* For Err or Sym or Str free the string data */
-        case LVAL_ERR: free(v->err); break;
-        case LVAL_SYM: free(v->sym); break;
-        case LVAL_STR: free(v->str); break;
+        /* For Err or Str free the string data */
+        case LVAL_ERR: free(LERR(v)); break;
+        case LVAL_STR: free(LSTR(v)); break;
+        
+        /* Do nothing special for Sym bound to a slot */
+        case LVAL_SYM: break;
         
         /* For Sexpr and Qexpr then delete all elements inside */
+        /* A view only lets go of the buffer it shares */
         case LVAL_SEXPR:
         case LVAL_QEXPR:
-            for (int i = 0; i < v->count; i++) {
-                lval_del(v->cell[i]);
+            if (LVEC(v)) { lvec_del(LVEC(v)); break; }
+            for (int i = 0; i < LCOUNT(v); i++) {
+                lval_del(LCELL(v)[i]);
             }
             /* Also free the memory allocated to contain the pointers */
-            free(v->cell);
+            lpool_array_del((void**)LCELL(v), LCAP(v));
             break;
         
         /* For Function and Lambda delete as well */
         case LVAL_FUN:
-            if (!v->builtin) {
-                lenv_del(v->env);
-                lval_del(v->formals);
-                lval_del(v->body);
+            if (!LBUILTIN(v)) {
+                lenv_del(LENV(v));
+                lval_del(LFORMALS(v));
+                lval_del(LBODY(v));
+            } else if (LMEMO(v)) {
+                lmemo_del(LMEMO(v));
             }
             break;
+        
+        /* For Vector free the packed data */
+        case LVAL_VEC: free(v->u.pack.data); break;
+        case LVAL_MAT: free(LMDATA(v)); break;
+        
+        /* For Map let go of the root, deleting the nodes no other */
+        /* version of the Map shares */
+        case LVAL_MAP: lhamt_del(LHROOT(v)); break;
+        
+        /* For Array delete every slot, then the slots themselves */
+        case LVAL_ARRAY:
+            for (int i = 0; i < LACOUNT(v); i++) { lval_del(LASLOT(v)[i]); }
+            lpool_array_del((void**)LASLOT(v), LACAP(v));
+            break;
     }
     
     /* Free the memory allocated for the "lval" struct itself */
-    free(v);
+    lval_free(v);
 }
 
 /* Delete an "lenv" */
 void lenv_del(lenv* e) {
     for (int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+        if (e->vals[i]) { lval_del(e->vals[i]); }
+        if (e->scope) { e->syms[i]->binds--; }
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    if (!e->scope || e->syms != e->scope->syms) {
+        lpool_array_del((void**)e->syms, e->cap);
+    }
+    lpool_array_del((void**)e->vals, e->cap);
+    free(e->index);
+    if (e->scope) { lscope_del(e->scope); }
+    lpool_put(&lpool_envs, e);
 }
 
+#ifdef LISPY_MPC_READER
+
 /* Read a number into "lval" */
 lval* lval_read_num(mpc_ast_t* t) {
     errno = 0;
@@ -254,14 +893,73 @@ lval* lval_read_str(mpc_ast_t* t) {
     return str;
 }
 
+#endif
+
+/* Construct a pointer to a new empty "lvec" with room for "cap" cells */
+/* starting from "lo", and no owners until a view is made of it */
+lvec* lvec_new(int cap, int lo) {
+    lvec* b = malloc(sizeof(lvec) + sizeof(lval*) * cap);
+    b->rc = 0;
+    b->lo = lo;
+    b->hi = lo;
+    b->cap = cap;
+    return b;
+}
+
+/* Delete an "lvec" once no view uses it */
+void lvec_del(lvec* b) {
+    if (--b->rc > 0) { return; }
+    for (int i = b->lo; i < b->hi; i++) { lval_del(b->cell[i]); }
+    free(b);
+}
+
+/* Construct a list of "type" viewing the "count" cells of "b" at "at" */
+lval* lval_view(int type, lvec* b, lval** at, int count) {
+    lval* v = lval_alloc();
+    v->type = type;
+    v->rc = 1;
+    LCOUNT(v) = count;
+    LCAP(v) = 0;
+    LCELL(v) = at;
+    LVEC(v) = b;
+    b->rc++;
+    return v;
+}
+
+/* Share the cells "i" up to "j" of the list "x" as a Q-Expression */
+/* A view of a view is free, an owned list is first copied to a buffer */
+lval* lval_slice(lval* x, int i, int j) {
+    if (LVEC(x)) { return lval_view(LVAL_QEXPR, LVEC(x), LCELL(x) + i, j - i); }
+    lvec* b = lvec_new(j - i, 0);
+    for (int k = i; k < j; k++) { b->cell[b->hi++] = lval_ref(LCELL(x)[k]); }
+    return lval_view(LVAL_QEXPR, b, b->cell, j - i);
+}
+
+/* Give a view cells of its own so that it can be changed */
+void lval_unview(lval* v) {
+    lvec* b = LVEC(v);
+    LCAP(v) = lpool_cap(LCOUNT(v));
+    lval** cell = (lval**)lpool_array(LCAP(v));
+    for (int i = 0; i < LCOUNT(v); i++) { cell[i] = lval_ref(LCELL(v)[i]); }
+    LCELL(v) = cell;
+    LVEC(v) = NULL;
+    lvec_del(b);
+}
+
 /* Add into "lval" */
 lval* lval_add(lval* v, lval* x) {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count - 1] = x;
+    if (LVEC(v)) { lval_unview(v); }
+    /* Only grow when the capacity is used up */
+    if (LCOUNT(v) == LCAP(v)) {
+        LCELL(v) = (lval**)lpool_array_grow(
+                (void**)LCELL(v), LCOUNT(v), &LCAP(v));
+    }
+    LCELL(v)[LCOUNT(v)++] = x;
     return v;
 }
 
+#ifdef LISPY_MPC_READER
+
 /* Read into "lval" */
 lval* lval_read(mpc_ast_t* t) {
     
@@ -291,970 +989,4659 @@ lval* lval_read(mpc_ast_t* t) {
     return x;
 }
 
-void lval_print(lval*);
+/* With mpc all of the text is read first, then handed out a form at a time */
+typedef struct {
+    lval* forms;
+    int i;
+    char* err;
+} lreader;
 
-/* Print the Expr part of an "lval" */
-void lval_expr_print(lval* v, char open, char close) {
-    putchar(open);
-    for (int i = 0; i < v->count; i++) {
-        
-        /* Print Value contained within */
-        lval_print(v->cell[i]);
-         
-        /* Don't print trailing space if last element */
-        if (i != (v->count - 1)) {
-            putchar(' ');
-        }
+/* Take the result of an mpc parse */
+void lread_result(lreader* r, int ok, mpc_result_t* res) {
+    r->forms = NULL;
+    r->i = 0;
+    r->err = NULL;
+    if (ok) {
+        r->forms = lval_read(res->output);
+        mpc_ast_delete(res->output);
+    } else {
+        r->err = mpc_err_string(res->error);
+        mpc_err_delete(res->error);
     }
-    putchar(close);
 }
 
-/* Print an String "lval" */
-void lval_print_str(lval* v) {
-    /* Make a Copy of the string */
-    char* escaped = malloc(strlen(v->str) + 1);
-    strcpy(escaped, v->str);
-    /* Pass it through the escape function */
-    escaped = mpcf_escape(escaped);
-    /* Print it between " characters */
-    printf("\"%s\"", escaped);
-    /* free the copied string */
-    free(escaped);
+/* Start reading "len" bytes of text from "s" */
+void lread_init(lreader* r, const char* name, const char* s, long len) {
+    mpc_result_t res;
+    lread_result(r, mpc_parse(name, s, Lispy, &res), &res);
 }
 
-/* Print an "lval" */
-void lval_print(lval* v) {
-    switch (v->type) {
-        /* In the case the type is a number print it */
-        /* Then 'break' out of the switch. */
-        case LVAL_NUM: printf("%li", v->num); break;
-        case LVAL_DNUM: printf("%lf", v->dnum); break;
-        
-        /* In the case the type is an error */
-        case LVAL_ERR: printf("Error: %s", v->err); break;
-        
-        /* In the case the type is an symbol */
-        case LVAL_SYM: printf("%s", v->sym); break;
-        
-        /* In the case the type is an sexpr or qexpr */
-        case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-        case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
-        
-        /* In the case the type is an string */
-        case LVAL_STR: lval_print_str(v); break;
-        
-        /* In the case the type is an function or lambda */
-        case LVAL_FUN:
-            if (v->builtin) {
-                printf("<function>");
-            } else {
-                printf ("(\\ "); lval_print(v->formals);
-                putchar(' '); lval_print(v->body); putchar(')');
-            }
-            break;
-    }
+/* Start reading the file "f", the same whether or not by "lines" */
+void lread_file(lreader* r, const char* name, FILE* f, int lines) {
+    mpc_result_t res;
+    lread_result(r, mpc_parse_file(name, f, Lispy, &res), &res);
 }
 
-/* Print an "lval" followed by a newline */
-void lval_println(lval* v) { lval_print(v); putchar('\n'); }
+/* Next top level expression, or NULL at the end or on error */
+lval* lread_next(lreader* r) {
+    if (!r->forms || r->i == LCOUNT(r->forms)) { return NULL; }
+    return lval_ref(LCELL(r->forms)[r->i++]);
+}
 
-lenv* lenv_copy(lenv*);
+void lread_close(lreader* r) {
+    if (r->forms) { lval_del(r->forms); }
+    free(r->err);
+}
 
-/* Copy a "lval" */
-lval* lval_copy(lval* v) {
-    
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
-    
-    switch(v->type) {
-        
-        /* Copy Functions and Numbers Directly */
-        case LVAL_FUN:
-            if (v->builtin) {
-                x->builtin = v->builtin;
-            } else {
-                x->builtin = NULL;
-                x->env = lenv_copy(v->env);
-                x->formals = lval_copy(v->formals);
-                x->body = lval_copy(v->body);
-            }
-            break;
-        case LVAL_NUM: x->num = v->num; break;
-        case LVAL_DNUM: x->dnum = v->dnum; break;
-        
-        /* Copy Strings using malloc and strcpy */
-        case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err); break;
-        
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->sym, v->sym); break;
-        
-        case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str, v->str); break;
-        
-        /* Copy Lists by copying each sub-expression */
-        case LVAL_SEXPR:
-        case LVAL_QEXPR:
-            x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
-            for (int i = 0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
-            break;
-    }
-    
-    return x;
+#else
+
+/* Reader */
+/* Reads source text straight into "lval" in a single pass over its bytes. */
+/* It takes the forms of the grammar mpc was once given for this, and on */
+/* bad input reports the error mpc gave, at the same line and column. */
+/* Any change to the forms it gives must bump LREAD_REVISION. */
+
+/* What came just before the reader's position, which changes what an */
+/* error there says could have come next */
+enum { LREAD_SPACE, LREAD_NUM, LREAD_DNUM, LREAD_MINUS, LREAD_SYM,
+       LREAD_COMMENT, LREAD_OTHER };
+
+/* A file is read a piece at a time into "buf", which always holds the */
+/* whole of the expression being read. "base" is where "buf" starts in */
+/* the text and "line" where the current line does. "scan" and "depth" */
+/* are how far into the next expression it has been found to go on. */
+typedef struct {
+    const char* name;
+    const char* p;
+    const char* end;
+    int row;
+    long line;
+    int last;
+    char* err;
+    FILE* f;
+    int lines;
+    const char* buf;
+    long cap;
+    long base;
+    long scan;
+    int depth;
+} lreader;
+
+/* Bytes of a file first read at once */
+#ifndef LREAD_CHUNK
+#define LREAD_CHUNK 65536
+#endif
+
+/* Where in the text a pointer into the buffer is */
+#define LREAD_AT(r, q) ((r)->base + ((q) - (r)->buf))
+
+static const char* lread_digit = "one of '0123456789'";
+static const char* lread_digits = "one or more of one of '0123456789'";
+static const char* lread_symchar =
+    "one of 'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "0123456789_+-*/\\=<>!&'";
+static const char* lread_symchars =
+    "one or more of one of 'abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+    "0123456789_+-*/\\=<>!&'";
+
+/* Start reading "len" bytes of text from "s" */
+void lread_init(lreader* r, const char* name, const char* s, long len) {
+    r->name = name;
+    r->p = s;
+    r->end = s + len;
+    r->row = 0;
+    r->line = 0;
+    r->last = LREAD_SPACE;
+    r->err = NULL;
+    r->f = NULL;
+    r->lines = 0;
+    r->buf = s;
+    r->cap = 0;
+    r->base = 0;
+    r->scan = 0;
+    r->depth = 0;
 }
 
-/* Copy an "lenv" */
-lenv* lenv_copy(lenv* e) {
-    lenv* n = malloc(sizeof(lenv));
-    n->par = e->par;
-    n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
-    for (int i = 0; i < e->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
-    }
-    return n;
+/* Start reading the file "f", a line at a time if "lines" is set so */
+/* that each expression is read as soon as its last line comes in */
+void lread_file(lreader* r, const char* name, FILE* f, int lines) {
+    char* buf = malloc(LREAD_CHUNK);
+    lread_init(r, name, "", 0);
+    r->buf = r->p = r->end = buf;
+    r->f = f;
+    r->lines = lines;
+    r->cap = LREAD_CHUNK;
 }
 
-/* Get name for a type */
-char* ltype_name(int t) {
-    switch(t) {
-        case LVAL_FUN: return "Function";
-        case LVAL_NUM: return "Number";
-        case LVAL_DNUM: return "Double";
-        case LVAL_ERR: return "Error";
-        case LVAL_SYM: return "Symbol";
-        case LVAL_STR: return "String";
-        case LVAL_SEXPR: return "S-Expression";
-        case LVAL_QEXPR: return "Q-Expression";
-        default: return "Unknown";
-    }
+void lread_close(lreader* r) {
+    if (r->cap) { free((char*)r->buf); }
+    free(r->err);
 }
 
-lval* lval_eval(lenv*, lval*);
+/* A nul byte is taken as mpc took it: finding it with "strchr" in */
+/* every set of characters, it went on digits, symbols and whitespace, */
+/* but ended strings and comments */
+static int lread_is_digit(int c) { return (c >= '0' && c <= '9') || !c; }
 
-/* "Pop" an element from the list in an "lval" */
-lval* lval_pop(lval* v, int i) {
-    /* Find the item it "i" */
-    lval* x = v->cell[i];
-    
-    /* Shift memory after the item at "i" over the top */
-    memmove(&v->cell[i], &v->cell[i + 1],
-            sizeof(lval*) * (v->count - i - 1));
-    
-    /* Decrease the count of items in the list */
-    v->count--;
-    
-    /* Reallocate the memory used */
-    v->cell = realloc(v->cell, sizeof(lval*) * (v->count));
-    return x;
+static int lread_is_sym(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || strchr("_+-*/\\=<>!&", c);
 }
 
-/* "Take" an element from the list in an "lval" */
-lval* lval_take(lval* v, int i) {
-    lval* x = lval_pop(v, i);
-    lval_del(v);
-    return x;
+/* Name of a character as mpc gives it in errors */
+const char* lread_char_name(char c, char* buf) {
+    switch (c) {
+        case '\a': return "bell";
+        case '\b': return "backspace";
+        case '\f': return "formfeed";
+        case '\r': return "carriage return";
+        case '\v': return "vertical tab";
+        case '\0': return "end of input";
+        case '\n': return "newline";
+        case '\t': return "tab";
+        case ' ' : return "space";
+    }
+    buf[0] = '\''; buf[1] = c; buf[2] = '\''; buf[3] = '\0';
+    return buf;
 }
 
-/* "Get" an variable from an "lenv" */
-lval* lenv_get(lenv* e, lval* k) {
+/* Fail at the current position, having expected any of "n" things */
+void lread_fail(lreader* r, int n, const char** expected) {
+    char* b = malloc(1024);
+    int k = snprintf(b, 1024, "%s:%i:%i: error: expected ", r->name,
+            r->row + 1, (int)(LREAD_AT(r, r->p) - r->line) + 1);
     
-    /* Iterate over all items in enviroment */
-    for (int i = 0; i < e->count; i++) {
-        /* Check if the stored string matches the symbol string */
-        /* If it does, return a copy of the value */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            return lval_copy(e->vals[i]);
-        }
+    /* Each thing is named once, in the order first expected */
+    const char* seen[16];
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        int j = 0;
+        while (j < m && strcmp(seen[j], expected[i]) != 0) { j++; }
+        if (j == m) { seen[m++] = expected[i]; }
     }
-    /* If no symbol found check in parents, otherwise return error */
-    if (e->par) {
-        return lenv_get(e->par, k);
-    } else {
-        return lval_err("Unbound symbol '%s'", k->sym);
+    for (int i = 0; i < m; i++) {
+        const char* sep = i == 0 ? "" : i == m - 1 ? " or " : ", ";
+        k += snprintf(b + k, 1024 - k, "%s%s", sep, seen[i]);
     }
+    
+    char buf[4];
+    char c = r->p < r->end ? *r->p : '\0';
+    snprintf(b + k, 1024 - k, " at %s\n", lread_char_name(c, buf));
+    r->err = b;
 }
 
-/* "Put" an variable into an "lenv" */
-void lenv_put(lenv* e, lval* k, lval* v) {
+/* Fail where an expression or "close" should be, "close" being 0 at */
+/* the top level where only the end of input may follow */
+void lread_fail_expr(lreader* r, char close) {
+    const char* expected[16];
+    int n = 0;
     
-    /* Iterate over all items in enviroment */
-    /* This is to see if variable alreeady exists */
-    for (int i = 0; i < e->count; i++) {
-        
-        /* If variable is found delete item at that position */
-        /* And replace with variable supplied by user */
-        if (strcmp(e->syms[i], k->sym) == 0) {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    /* A token right before could also have gone on */
+    switch (r->last) {
+        case LREAD_NUM: expected[n++] = lread_digit; expected[n++] = "'.'"; break;
+        case LREAD_DNUM: expected[n++] = lread_digit; break;
+        case LREAD_MINUS: expected[n++] = lread_digits; /* fallthrough */
+        case LREAD_SYM: expected[n++] = lread_symchar; break;
+        case LREAD_COMMENT: expected[n++] = "none of '\r\n'"; break;
     }
     
-    /* If no existing entry found allocate space for new entry */
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
-    
-    /* Copy contents of lval and symbol string into new location */
-    e->vals[e->count - 1] = lval_copy(v);
-    e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-    strcpy(e->syms[e->count - 1], k->sym);
+    expected[n++] = "'-'";
+    expected[n++] = lread_digits;
+    expected[n++] = lread_symchars;
+    expected[n++] = "'\"'";
+    expected[n++] = "';'";
+    expected[n++] = "'('";
+    expected[n++] = "'{'";
+    expected[n++] = close == ')' ? "')'" : close == '}' ? "'}'" : "end of input";
+    lread_fail(r, n, expected);
 }
 
-/* "Define" an variable in the most-parent "lenv" */
-void lenv_def(lenv* e, lval* k, lval* v) {
-    /* Iterate till w has no parent */
-    while (e->par) { e = e->par; }
-    /* Put value in e */
-    lenv_put(e, k, v);
+/* Skip whitespace, keeping count of lines */
+void lread_space(lreader* r) {
+    const char* p = r->p;
+    while (p < r->end) {
+        char c = *p;
+        if (c == '\n') {
+            r->row++;
+            r->line = LREAD_AT(r, p + 1);
+        } else if (c != ' ' && c != '\t' && c != '\r' && c != '\f' && c != '\v'
+                && c) {
+            break;
+        }
+        p++;
+    }
+    if (p != r->p) { r->last = LREAD_SPACE; }
+    r->p = p;
+}
+
+/* Skip a comment up to the end of its line */
+void lread_comment(lreader* r) {
+    const char* p = r->p + 1;
+    while (p < r->end && *p != '\n' && *p != '\r' && *p) { p++; }
+    r->p = p;
+    r->last = LREAD_COMMENT;
 }
 
-/* "Join" two lists in two "lval"s */
-lval* lval_join(lval* x, lval* y) {
-    /* For each cell in 'y' add it to 'x' */
-    while (y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+/* Read a Number or Double */
+lval* lread_num(lreader* r) {
+    const char* s = r->p;
+    const char* p = s;
+    if (*p == '-') { p++; }
+    while (p < r->end && lread_is_digit(*p)) { p++; }
+    
+    /* A point must have digits after it */
+    int dbl = p < r->end && *p == '.';
+    if (dbl) {
+        p++;
+        if (p == r->end || !lread_is_digit(*p)) {
+            r->p = p;
+            lread_fail(r, 1, &lread_digits);
+            return NULL;
+        }
+        while (p < r->end && lread_is_digit(*p)) { p++; }
     }
+    r->p = p;
+    r->last = dbl ? LREAD_DNUM : LREAD_NUM;
     
-    /* Delete the empty 'y' and return 'x' */
-    lval_del(y);
+    /* Convert from a terminated copy, as the text may run on */
+    char buf[64];
+    long len = p - s;
+    char* t = len < 64 ? buf : malloc(len + 1);
+    memcpy(t, s, len);
+    t[len] = '\0';
+    
+    errno = 0;
+    lval* x;
+    if (dbl) {
+        double d = strtod(t, NULL);
+        x = errno != ERANGE ? lval_dnum(d) : lval_err("invalid number");
+    } else {
+        long n = strtol(t, NULL, 10);
+        x = errno != ERANGE ? lval_num(n) : lval_err("invalid number");
+    }
+    if (t != buf) { free(t); }
     return x;
 }
 
-lval* builtin_eval(lenv*, lval*);
-lval* builtin_list(lenv*, lval*);
+/* Read a Symbol */
+lval* lread_sym(lreader* r) {
+    const char* s = r->p;
+    const char* p = s;
+    while (p < r->end && lread_is_sym(*p)) { p++; }
+    r->p = p;
+    r->last = (p - s == 1 && *s == '-') ? LREAD_MINUS : LREAD_SYM;
+    const char* nul = memchr(s, '\0', p - s);
+    return (lval*)((uintptr_t)lsym_intern_n(s, (nul ? nul : p) - s) |
+            LVAL_IMM_SYM);
+}
 
-/* "Call" an "lval" */
-lval* lval_call(lenv* e, lval* f, lval* a) {
+/* Read a String, unescaping it as it is copied */
+lval* lread_str(lreader* r) {
+    const char* s = r->p + 1;
+    const char* p = s;
     
-    /* If Builtin then simply apply that */
-    if (f->builtin) { return f->builtin(e, a); }
+    /* Find the closing quote, stepping over escaped characters */
+    while (p < r->end && *p != '"' && *p) {
+        if (*p == '\\' && p + 1 < r->end) {
+            p++;
+        }
+        if (*p == '\n') {
+            r->row++;
+            r->line = LREAD_AT(r, p + 1);
+        }
+        p++;
+    }
+    if (p == r->end || !*p) {
+        r->p = p;
+        const char* expected[4];
+        int n = 0;
+        /* A lone backslash at the very end might have escaped something */
+        int slashes = 0;
+        while (p - slashes > s && p[-slashes - 1] == '\\') { slashes++; }
+        if (slashes % 2) { expected[n++] = "any character"; }
+        expected[n++] = "'\\'";
+        expected[n++] = "none of '\"'";
+        expected[n++] = "'\"'";
+        lread_fail(r, n, expected);
+        return NULL;
+    }
+    r->p = p + 1;
+    r->last = LREAD_OTHER;
     
-    /* Record Argument Counts */
-    int given = a->count;
-    int total = f->formals->count;
+    /* An escaped nul cut mpc's copy short, along with its backslash */
+    const char* nul = memchr(s, '\0', p - s);
+    if (nul) { p = nul - 1; }
     
-    /* While Arguments still remain to be processed */
-    while (a->count) {
-        
-        /* If we've ran out of formal arguments to bind */
-        if (f->formals->count == 0) {
-            lval_del(a);
-            return lval_err(
-                    "Function passed too many arguments. "
-                    "Got %i, Expected %i.", given, total);
+    lval* v = lval_alloc();
+    v->type = LVAL_STR;
+    v->rc = 1;
+    char* d = LSTR(v) = malloc(p - s + 1);
+    for (const char* q = s; q < p; q++) {
+        if (*q != '\\' || q + 1 == p) { *d++ = *q; continue; }
+        switch (q[1]) {
+            case 'a': *d++ = '\a'; break;
+            case 'b': *d++ = '\b'; break;
+            case 'f': *d++ = '\f'; break;
+            case 'n': *d++ = '\n'; break;
+            case 'r': *d++ = '\r'; break;
+            case 't': *d++ = '\t'; break;
+            case 'v': *d++ = '\v'; break;
+            case '\\': *d++ = '\\'; break;
+            case '\'': *d++ = '\''; break;
+            case '"': *d++ = '"'; break;
+            /* An escaped nul ends nothing, it is just left out */
+            case '0': break;
+            default: *d++ = *q; continue;
         }
+        q++;
+    }
+    *d = '\0';
+    return v;
+}
+
+lval* lread_expr(lreader*, char);
+
+/* Read the expressions of a list into "x" up to the character "close" */
+lval* lread_list(lreader* r, lval* x, char close) {
+    r->p++;
+    r->last = LREAD_OTHER;
+    while (1) {
+        lread_space(r);
+        if (r->p < r->end && *r->p == close) { break; }
+        if (r->p < r->end && *r->p == ';') { lread_comment(r); continue; }
+        if (r->p == r->end) {
+            lread_fail_expr(r, close);
+            lval_del(x);
+            return NULL;
+        }
+        lval* y = lread_expr(r, close);
+        if (!y) {
+            lval_del(x);
+            return NULL;
+        }
+        lval_add(x, y);
+    }
+    r->p++;
+    r->last = LREAD_OTHER;
+    return x;
+}
+
+/* Read one expression inside a list closed by "close", or NULL on error */
+lval* lread_expr(lreader* r, char close) {
+    char c = *r->p;
+    if (lread_is_digit(c) ||
+        (c == '-' && r->p + 1 < r->end && lread_is_digit(r->p[1]))) {
+        return lread_num(r);
+    }
+    if (lread_is_sym(c)) { return lread_sym(r); }
+    if (c == '"') { return lread_str(r); }
+    if (c == '(') { return lread_list(r, lval_sexpr(), ')'); }
+    if (c == '{') { return lread_list(r, lval_qexpr(), '}'); }
+    lread_fail_expr(r, close);
+    return NULL;
+}
+
+/* Whether the buffer holds the whole of the next expression, so that */
+/* reading it will not run into the end of the buffer */
+int lread_whole(lreader* r) {
+    const char* p = r->p + r->scan;
+    int depth = r->depth;
+    while (p < r->end) {
+        /* Pick up from here after reading more */
+        r->scan = p - r->p;
+        r->depth = depth;
         
-        /* Pop the first symbol from the formals */
-        lval* sym = lval_pop(f->formals, 0);
-        
-        /* Special Case to deal with '&' */
-        if (strcmp(sym->sym, "&") == 0) {
-            
-            /* Ensure '&' is followed by another symbol */
-            if (f->formals->count != 1) {
-                lval_del(a);
-                return lval_err("Function format invalid. "
-                        "Symbol '&' not followed by single symbol.");
+        char c = *p++;
+        if (c == ';') {
+            while (p < r->end && *p != '\n' && *p != '\r' && *p) { p++; }
+            if (p == r->end) { return 0; }
+        } else if (c == '"') {
+            while (p < r->end && *p != '"' && *p) { p += *p == '\\' ? 2 : 1; }
+            if (p >= r->end) { return 0; }
+            if (!depth) { return 1; }
+            p++;
+        } else if (c == '(' || c == '{') {
+            depth++;
+        } else if (c == ')' || c == '}') {
+            if (--depth <= 0) { return 1; }
+        } else if (c && !strchr(" \t\n\r\f\v", c)) {
+            /* Anything else runs up to the next delimiter */
+            while (p < r->end && !(*p && strchr(" \t\n\r\f\v(){};\"", *p))) {
+                p++;
             }
-            
-            /* Next formal should be bound to remaining arguments */
-            lval* nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym); lval_del(nsym);
-            break;
+            if (p == r->end) { return 0; }
+            if (!depth) { return 1; }
         }
-         
-        /* Pop the next argument from the list */
-        lval* val = lval_pop(a, 0);
-        
-        /* Bind a copy into the function's enviroment */
-        lenv_put(f->env, sym, val);
-        
-        /* Delete symbol and value */
-        lval_del(sym); lval_del(val);
+    }
+    return 0;
+}
+
+/* Read more of the file, keeping the text from the reader's position */
+/* on, giving 0 once the file has run out */
+int lread_more(lreader* r) {
+    char* b = (char*)r->buf;
+    long keep = r->end - r->p;
+    r->base += r->p - r->buf;
+    memmove(b, r->p, keep);
+    if (keep * 2 > r->cap) {
+        r->cap *= 2;
+        b = realloc(b, r->cap);
     }
     
-    /* Argument list is now bound so can be cleaned up */
-    lval_del(a);
+    long n = 0;
+    if (r->lines) {
+        int c;
+        while (keep + n < r->cap && (c = getc(r->f)) != EOF) {
+            b[keep + n++] = c;
+            if (c == '\n') { break; }
+        }
+    } else {
+        n = fread(b + keep, 1, r->cap - keep, r->f);
+    }
     
-    /* If '&' remains in formal list bind to empty list */
-    if (f->formals->count > 0 &&
-            strcmp(f->formals->cell[0]->sym, "&") == 0) {
+    r->buf = b;
+    r->p = b;
+    r->end = b + keep + n;
+    if (!n) { r->f = NULL; }
+    return n > 0;
+}
+
+/* Have the buffer hold the whole of the next expression or, once the */
+/* file has run out, all that is left of it */
+void lread_fill(lreader* r) {
+    while (r->f && !lread_whole(r)) {
         
-        /* Check to ensure that & is not passed invalidly */
-        if (f->formals->count != 2) {
-            return lval_err("Function format invalid. "
-                    "Symbol '&' not followed by single symbol.");
+        /* Whitespace and comments that have ended need not be kept */
+        const char* p = r->p;
+        while (1) {
+            lread_space(r);
+            if (r->p == r->end || *r->p != ';') { break; }
+            const char* q = r->p + 1;
+            while (q < r->end && *q != '\n' && *q != '\r' && *q) { q++; }
+            if (q == r->end) { break; }
+            lread_comment(r);
+        }
+        if (r->scan > r->p - p) {
+            r->scan -= r->p - p;
+        } else {
+            r->scan = 0;
+            r->depth = 0;
         }
         
-        /* Pop and delete '&' symbol */
-        lval_del(lval_pop(f->formals, 0));
-        
-        /* Pop next symbol and create empty list */
-        lval* sym = lval_pop(f->formals, 0);
-        lval* val = lval_qexpr();
+        lread_more(r);
+    }
+    r->scan = 0;
+    r->depth = 0;
+}
+
+/* Read the next top level expression, or NULL at the end or on error */
+lval* lread_next(lreader* r) {
+    if (r->err) { return NULL; }
+    if (r->f) { lread_fill(r); }
+    while (1) {
+        lread_space(r);
+        if (r->p == r->end) { return NULL; }
+        if (*r->p != ';') { return lread_expr(r, 0); }
+        lread_comment(r);
+    }
+}
+
+#endif
+
+/* Read all of "len" bytes of text from "s" as an S-Expression of the */
+/* expressions in it, or NULL with "*err" set to the error */
+lval* lread_all(const char* name, const char* s, long len, char** err) {
+    lreader r;
+    lread_init(&r, name, s, len);
+    lval* x = lval_sexpr();
+    lval* y;
+    while ((y = lread_next(&r))) { lval_add(x, y); }
+    if (r.err) {
+        lval_del(x);
+        *err = r.err;
+        r.err = NULL;
+        x = NULL;
+    }
+    lread_close(&r);
+    return x;
+}
+
+void lval_print(lval*);
+
+/* Print the Expr part of an "lval" */
+void lval_expr_print(lval* v, char open, char close) {
+    putchar(open);
+    for (int i = 0; i < LCOUNT(v); i++) {
         
-        /* Bind to enviroment and delete */
-        lenv_put(f->env, sym, val);
-        lval_del(sym); lval_del(val);
+        /* Print Value contained within */
+        lval_print(LCELL(v)[i]);
+         
+        /* Don't print trailing space if last element */
+        if (i != (LCOUNT(v) - 1)) {
+            putchar(' ');
+        }
     }
-    
-    /* If all formals have been bound, evaluate. */
-    if (f->formals->count == 0) {
+    putchar(close);
+}
+
+/* Print an String "lval" */
+void lval_print_str(lval* v) {
+    /* Make a Copy of the string */
+    char* escaped = malloc(strlen(LSTR(v)) + 1);
+    strcpy(escaped, LSTR(v));
+    /* Pass it through the escape function */
+    escaped = mpcf_escape(escaped);
+    /* Print it between " characters */
+    printf("\"%s\"", escaped);
+    /* free the copied string */
+    free(escaped);
+}
+
+/* Print a Vector "lval" between square brackets */
+void lval_vec_print(lval* v) {
+    putchar('[');
+    for (int i = 0; i < LVCOUNT(v); i++) {
+        if (i) { putchar(' '); }
+        if (LVDBL(v)) {
+            printf("%lf", LVDNUMS(v)[i]);
+        } else {
+            printf("%li", LVNUMS(v)[i]);
+        }
+    }
+    putchar(']');
+}
+
+/* Print a Matrix "lval" as square brackets around its rows */
+void lval_mat_print(lval* v) {
+    putchar('[');
+    for (int i = 0; i < LMROWS(v); i++) {
+        if (i) { putchar(' '); }
+        putchar('[');
+        for (int j = 0; j < LMCOLS(v); j++) {
+            if (j) { putchar(' '); }
+            printf("%lf", LMDATA(v)[(size_t)i * LMCOLS(v) + j]);
+        }
+        putchar(']');
+    }
+    putchar(']');
+}
+
+/* Print an Array "lval" between #( and ) */
+void lval_array_print(lval* v) {
+    printf("#(");
+    for (int i = 0; i < LACOUNT(v); i++) {
+        if (i) { putchar(' '); }
+        lval_print(LASLOT(v)[i]);
+    }
+    putchar(')');
+}
+
+/* Print the keys and values under a node of a Map */
+void lhamt_print(lhamt* n, int* first) {
+    for (int i = 0; n && i < n->count; i++) {
+        if (n->ent[i].sub) { lhamt_print(n->ent[i].sub, first); continue; }
+        if (!*first) { putchar(' '); }
+        *first = 0;
+        lval_print(n->ent[i].key);
+        putchar(' ');
+        lval_print(n->ent[i].val);
+    }
+}
+
+/* Print a Map "lval" as its keys and values between #{ and } */
+void lval_map_print(lval* v) {
+    int first = 1;
+    printf("#{");
+    lhamt_print(LHROOT(v), &first);
+    putchar('}');
+}
+
+/* Print an "lval" */
+void lval_print(lval* v) {
+    switch (LTYPE(v)) {
+        /* In the case the type is a number print it */
+        /* Then 'break' out of the switch. */
+        case LVAL_NUM: printf("%li", LNUM(v)); break;
+        case LVAL_DNUM: printf("%lf", LDNUM(v)); break;
+        
+        /* In the case the type is an error */
+        case LVAL_ERR: printf("Error: %s", LERR(v)); break;
         
-        /* Set enviroment parent to evaluation enviroment */
-        f->env->par = e;
+        /* In the case the type is an symbol */
+        case LVAL_SYM: printf("%s", LSYM(v)); break;
         
-        /* Evaluate and return */
-        return builtin_eval(
-                f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    } else {
-        /* Otherwise return partially evaluated function */
-        return lval_copy(f);
+        /* In the case the type is an sexpr or qexpr */
+        case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
+        case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+        
+        /* In the case the type is an string */
+        case LVAL_STR: lval_print_str(v); break;
+        
+        /* In the case the type is an vector */
+        case LVAL_VEC: lval_vec_print(v); break;
+        case LVAL_MAT: lval_mat_print(v); break;
+        case LVAL_ARRAY: lval_array_print(v); break;
+        case LVAL_MAP: lval_map_print(v); break;
+        
+        /* In the case the type is an function or lambda */
+        case LVAL_FUN:
+            if (LBUILTIN(v)) {
+                printf("<function>");
+            } else {
+                printf ("(\\ "); lval_print(LFORMALS(v));
+                putchar(' '); lval_print(LBODY(v)); putchar(')');
+            }
+            break;
     }
-    
 }
 
-int comp_eq(double a, double b)
-{ return fabs(a - b) < 1e-9; }
+/* Print an "lval" followed by a newline */
+void lval_println(lval* v) { lval_print(v); putchar('\n'); }
 
-/* Equality operatoe */
-int lval_eq(lval* x, lval* y) {
+lenv* lenv_copy(lenv*);
+void lenv_reindex(lenv*);
+
+/* Copy a "lval", sharing its sub-expressions with the original */
+lval* lval_copy(lval* v) {
     
-    /* Different Types are always unequal */
-    if (x->type != y->type) { return 0; }
+    /* Immediates are their own copy */
+    if (LVAL_IMM(v)) { return v; }
     
-    /* Compare Based upon type */
-    switch (x->type) {
-        /* Compare Number Value */
-        case LVAL_NUM: return (x->num == y->num);
-        case LVAL_DNUM: return comp_eq(x->dnum, y->dnum);
-        
-        /* Compare String Values */
-        case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
-        case LVAL_STR: return (strcmp(x->str, y->str) == 0);
+    /* Arrays are shared, so changes through any copy are seen by all */
+    if (v->type == LVAL_ARRAY) { return lval_ref(v); }
+    
+    /* Maps never change, so a copy shares the same trie */
+    if (v->type == LVAL_MAP) {
+        lval* x = lval_alloc();
+        x->type = LVAL_MAP;
+        x->rc = 1;
+        LHROOT(x) = LHROOT(v);
+        LHCOUNT(x) = LHCOUNT(v);
+        if (LHROOT(x)) { LHROOT(x)->rc++; }
+        return x;
+    }
+    
+    lval* x = lval_alloc();
+    x->type = v->type;
+    x->rc = 1;
+    
+    switch(v->type) {
         
-        /* If builtin compare, otherwise compare formals and body */
+        /* Copy Functions and Numbers Directly */
         case LVAL_FUN:
-            if (x->builtin || y->builtin) {
-                return x->builtin == y->builtin;
+            if (LBUILTIN(v)) {
+                LBUILTIN(x) = LBUILTIN(v);
+                LENV(x) = NULL;
+                LFORMALS(x) = NULL;
+                LBODY(x) = NULL;
+                /* Copies of a memo function share its cache */
+                LMEMO(x) = LMEMO(v);
+                if (LMEMO(x)) { LMEMO(x)->rc++; }
             } else {
-                return lval_eq(x->formals, y->formals) &&
-                    lval_eq(x->body, y->body);
+                LBUILTIN(x) = NULL;
+                LENV(x) = lenv_copy(LENV(v));
+                LFORMALS(x) = lval_ref(LFORMALS(v));
+                LBODY(x) = lval_ref(LBODY(v));
             }
+            break;
+        case LVAL_NUM: x->u.num = v->u.num; break;
+        case LVAL_DNUM: x->u.dnum = v->u.dnum; break;
         
-        /* If list compare every individual element */
+        /* Copy Slot Symbols directly */
+        case LVAL_SYM: x->u.local = v->u.local; break;
+        
+        /* Copy Strings using malloc and strcpy */
+        case LVAL_ERR:
+            LERR(x) = malloc(strlen(LERR(v)) + 1);
+            strcpy(LERR(x), LERR(v)); break;
+        
+        case LVAL_STR:
+            LSTR(x) = malloc(strlen(LSTR(v)) + 1);
+            strcpy(LSTR(x), LSTR(v)); break;
+        
+        /* Copy Lists by sharing each sub-expression */
+        case LVAL_SEXPR:
         case LVAL_QEXPR:
+            LCOUNT(x) = LCOUNT(v);
+            LCAP(x) = lpool_cap(LCOUNT(x));
+            LCELL(x) = (lval**)lpool_array(LCAP(x));
+            LVEC(x) = NULL;
+            for (int i = 0; i < LCOUNT(x); i++) {
+                LCELL(x)[i] = lval_ref(LCELL(v)[i]);
+            }
+            break;
+        
+        /* Copy Vectors with memcpy */
+        case LVAL_VEC: {
+            size_t size = LVDBL(v) ? sizeof(double) : sizeof(long);
+            LVCOUNT(x) = LVCOUNT(v);
+            LVDBL(x) = LVDBL(v);
+            x->u.pack.data = malloc((LVCOUNT(x) ? LVCOUNT(x) : 1) * size);
+            memcpy(x->u.pack.data, v->u.pack.data, LVCOUNT(x) * size);
+            break;
+        }
+        case LVAL_MAT: {
+            size_t size = (size_t)LMROWS(v) * LMCOLS(v) * sizeof(double);
+            LMROWS(x) = LMROWS(v);
+            LMCOLS(x) = LMCOLS(v);
+            LMDATA(x) = malloc(size + sizeof(double));
+            memcpy(LMDATA(x), LMDATA(v), size);
+            break;
+        }
+    }
+    
+    return x;
+}
+
+/* Make sure nobody else shares an "lval" before it is modified */
+/* Views share their cells, so they are always copied */
+lval* lval_own(lval* v) {
+    if (LVAL_IMM(v)) { return v; }
+    int view = (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && LVEC(v);
+    if (v->rc == 1 && !view) { return v; }
+    lval* x = lval_copy(v);
+    lval_del(v);
+    return x;
+}
+
+/* Copy an "lenv" */
+lenv* lenv_copy(lenv* e) {
+    lenv* n = lpool_get(&lpool_envs, sizeof(lenv));
+    n->par = e->par;
+    n->count = e->count;
+    n->cap = lpool_cap(n->count);
+    n->vals = (lval**)lpool_array(n->cap);
+    n->scope = e->scope;
+    
+    /* Keep sharing the slot names of a frame if they are unchanged */
+    if (e->scope && e->syms == e->scope->syms) {
+        n->syms = e->syms;
+    } else {
+        n->syms = (lsym**)lpool_array(n->cap);
+        for (int i = 0; i < e->count; i++) { n->syms[i] = e->syms[i]; }
+    }
+    
+    for (int i = 0; i < e->count; i++) {
+        n->vals[i] = e->vals[i] ? lval_ref(e->vals[i]) : NULL;
+        if (n->scope) { n->syms[i]->binds++; }
+    }
+    if (n->scope) { n->scope->rc++; }
+    n->index = NULL;
+    n->index_cap = 0;
+    if (n->count > LENV_INDEX_MIN) { lenv_reindex(n); }
+    return n;
+}
+
+/* Rewrite references to the formals of "s" into slot Symbols */
+lval* lval_resolve(lval* v, lscope* s) {
+    switch (LTYPE(v)) {
+        case LVAL_SYM: {
+            int slot = lscope_slot(s, LSYMID(v));
+            if (slot < 0) { return v; }
+            lval* x = lval_local(LSYMID(v), s, slot);
+            lval_del(v);
+            return x;
+        }
+        
+        /* Resolve inside every list, copying only lists that change */
         case LVAL_SEXPR:
-            if (x->count != y->count) { return 0; }
-            for (int i = 0; i < x->count; i++) {
-                /* If any element not equal then whole list not equal */
-                if (!lval_eq(x->cell[i], y->cell[i])) { return 0; }
+        case LVAL_QEXPR:
+            for (int i = 0; i < LCOUNT(v); i++) {
+                lval* x = lval_resolve(lval_ref(LCELL(v)[i]), s);
+                if (x == LCELL(v)[i]) { lval_del(x); continue; }
+                v = lval_own(v);
+                lval_del(LCELL(v)[i]);
+                LCELL(v)[i] = x;
             }
-            /* Otherwise lists must be equal */
-            return 1;
+            return v;
+    }
+    return v;
+}
+
+/* Get name for a type */
+char* ltype_name(int t) {
+    switch(t) {
+        case LVAL_FUN: return "Function";
+        case LVAL_NUM: return "Number";
+        case LVAL_DNUM: return "Double";
+        case LVAL_ERR: return "Error";
+        case LVAL_SYM: return "Symbol";
+        case LVAL_STR: return "String";
+        case LVAL_SEXPR: return "S-Expression";
+        case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_VEC: return "Vector";
+        case LVAL_MAT: return "Matrix";
+        case LVAL_ARRAY: return "Array";
+        case LVAL_MAP: return "Map";
+        default: return "Unknown";
     }
-    return 0;
 }
 
-#define LASSERT(args, cond, err, ...) \
-    if (!(cond)) { lval* error = lval_err(err, ##__VA_ARGS__); lval_del(args); return error; }
+lval* lval_eval(lenv*, lval*);
+lval* lval_eval_sexpr(lenv*, lval*);
 
-#define LASSERT_FUN(fun) \
-    LASSERT(a, a->count == 1,\
-            "Function '" #fun "' passed incorrect number of arguments. "\
-            "Got %i, Expected %i.",\
-            a->count, 1);\
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR,\
-            "Function '" #fun "' passed incorrect type for argument 0. "\
-            "Got %s, Expected %s.",\
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR))
-#define LASSERT_NEMPTY(fun) \
-    LASSERT(a, a->cell[0]->count != 0,\
-            "Function '" #fun "' passed {}!")
+/* Add position "i" of an "lenv" to its hash index */
+void lenv_index_add(lenv* e, int i) {
+    int mask = e->index_cap - 1;
+    int j = e->syms[i]->hash & mask;
+    while (e->index[j]) { j = (j + 1) & mask; }
+    e->index[j] = i + 1;
+}
+
+/* Rebuild the hash index of an "lenv" with room to grow */
+void lenv_reindex(lenv* e) {
+    free(e->index);
+    e->index_cap = 16;
+    while (e->index_cap < e->count * 4) { e->index_cap *= 2; }
+    e->index = calloc(e->index_cap, sizeof(int));
+    for (int i = 0; i < e->count; i++) { lenv_index_add(e, i); }
+}
+
+/* Find the position of a symbol in a single "lenv", or -1 */
+static inline int lenv_find(lenv* e, lsym* k) {
+    
+    /* Probe the hash index if there is one */
+    if (e->index) {
+        int mask = e->index_cap - 1;
+        for (int j = k->hash & mask; e->index[j]; j = (j + 1) & mask) {
+            if (e->syms[e->index[j] - 1] == k) { return e->index[j] - 1; }
+        }
+        return -1;
+    }
+    
+    /* Otherwise iterate over all items in enviroment */
+    for (int i = 0; i < e->count; i++) {
+        /* Check if the stored symbol is the same interned symbol */
+        if (e->syms[i] == k) { return i; }
+    }
+    return -1;
+}
+
+/* The global enviroment every evaluation enviroment ends in */
+lenv* lenv_root;
+
+/* "Get" an variable from an "lenv" */
+lval* lenv_get(lenv* e, lval* k) {
+    
+    /* A Symbol resolved to a slot of this very frame needs no search */
+    if (!LVAL_IMM(k) && e->scope && k->u.local.scope == e->scope->id &&
+            e->vals[k->u.local.slot]) {
+        return lval_ref(e->vals[k->u.local.slot]);
+    }
+    
+    /* If no lambda frame binds the symbol only the global one can */
+    if (LSYMID(k)->binds == 0) { e = lenv_root; }
+    
+    /* Search this enviroment then each parent in turn */
+    for (; e; e = e->par) {
+        /* If found, return a shared reference to the value */
+        int i = lenv_find(e, LSYMID(k));
+        if (i >= 0 && e->vals[i]) { return lval_ref(e->vals[i]); }
+    }
+    /* If no symbol found anywhere return error */
+    return lval_err("Unbound symbol '%s'", LSYM(k));
+}
+
+/* "Put" an variable into an "lenv" */
+void lenv_put(lenv* e, lval* k, lval* v) {
+    
+    /* See if variable alreeady exists */
+    int i = lenv_find(e, LSYMID(k));
+    
+    /* If variable is found delete item at that position */
+    /* And replace with variable supplied by user */
+    if (i >= 0) {
+        lval_ref(v);
+        if (e->vals[i]) { lval_del(e->vals[i]); }
+        e->vals[i] = v;
+        return;
+    }
+    
+    /* If no existing entry found make space for new entry */
+    int cap = e->cap;
+    if (e->count == e->cap) {
+        e->vals = (lval**)lpool_array_grow((void**)e->vals, e->count, &cap);
+    }
+    if (e->scope && e->syms == e->scope->syms) {
+        /* Stop sharing the slot names of the frame's scope */
+        lsym** syms = (lsym**)lpool_array(cap);
+        for (int j = 0; j < e->count; j++) { syms[j] = e->syms[j]; }
+        e->syms = syms;
+    } else if (e->count == e->cap) {
+        e->syms = (lsym**)lpool_array_grow((void**)e->syms, e->count, &e->cap);
+    }
+    e->cap = cap;
+    e->count++;
+    
+    /* Share lval and symbol into new location */
+    e->vals[e->count - 1] = lval_ref(v);
+    e->syms[e->count - 1] = LSYMID(k);
+    if (e->scope) { LSYMID(k)->binds++; }
+    
+    /* Keep the hash index at most half full */
+    if (e->index && e->count * 2 <= e->index_cap) {
+        lenv_index_add(e, e->count - 1);
+    } else if (e->count > LENV_INDEX_MIN) {
+        lenv_reindex(e);
+    }
+}
+
+/* Bind a value to a slot of a call frame */
+void lenv_bind(lenv* e, int slot, lval* v) {
+    if (e->vals[slot]) { lval_del(e->vals[slot]); }
+    e->vals[slot] = v;
+}
+
+/* "Define" an variable in the most-parent "lenv" */
+void lenv_def(lenv* e, lval* k, lval* v) {
+    /* Iterate till w has no parent */
+    while (e->par) { e = e->par; }
+    /* Put value in e */
+    lenv_put(e, k, v);
+}
+
+lval* lcode_run(lenv*, lval*);
+
+/* Bind the borrowed arguments "argv" of the lambda "f" into a copy of */
+/* its frame. Returns the frame once every formal is bound, otherwise */
+/* NULL with the partially applied function or an error in "r" */
+lenv* lval_bind(lval* f, int argc, lval** argv, lval** r) {
+    
+    /* Bind into a fresh copy of the function's frame */
+    lval* formals = LFORMALS(f);
+    lenv* frame = lenv_copy(LENV(f));
+    int* slot_of = frame->scope->slot_of;
+    
+    /* Formals already bound by partial application come first */
+    int first = frame->scope->nformals - LCOUNT(formals);
+    
+    /* Record Argument Counts */
+    int given = argc;
+    int total = LCOUNT(formals);
+    
+    /* Bind each Argument in turn to the slot of the next formal */
+    int i = 0;
+    for (int j = 0; j < argc; j++) {
+        
+        /* If we've ran out of formal arguments to bind */
+        if (i == LCOUNT(formals)) {
+            lenv_del(frame);
+            *r = lval_err(
+                    "Function passed too many arguments. "
+                    "Got %i, Expected %i.", given, total);
+            return NULL;
+        }
+        
+        /* Special Case to deal with '&' */
+        if (LSYMID(LCELL(formals)[i]) == lsym_amp) {
+            
+            /* Ensure '&' is followed by another symbol */
+            if (LCOUNT(formals) - i != 2) {
+                lenv_del(frame);
+                *r = lval_err("Function format invalid. "
+                        "Symbol '&' not followed by single symbol.");
+                return NULL;
+            }
+            
+            /* Next formal should be bound to remaining arguments */
+            lval* rest = lval_qexpr();
+            for (; j < argc; j++) {
+                lval_add(rest, lval_ref(argv[j]));
+            }
+            lenv_bind(frame, slot_of[first + i + 1], rest);
+            i += 2;
+            break;
+        }
+        
+        /* Bind the argument into the formal's slot */
+        lenv_bind(frame, slot_of[first + i], lval_ref(argv[j]));
+        i++;
+    }
+    
+    /* If '&' remains in formal list bind to empty list */
+    if (i < LCOUNT(formals) && LSYMID(LCELL(formals)[i]) == lsym_amp) {
+        
+        /* Check to ensure that & is not passed invalidly */
+        if (LCOUNT(formals) - i != 2) {
+            lenv_del(frame);
+            *r = lval_err("Function format invalid. "
+                    "Symbol '&' not followed by single symbol.");
+            return NULL;
+        }
+        
+        lenv_bind(frame, slot_of[first + i + 1], lval_qexpr());
+        i += 2;
+    }
+    
+    /* If all formals have been bound the frame is ready */
+    if (i == LCOUNT(formals)) { return frame; }
+    
+    /* Otherwise return partially evaluated function */
+    lval* p = lval_alloc();
+    p->type = LVAL_FUN;
+    p->rc = 1;
+    LBUILTIN(p) = NULL;
+    LENV(p) = frame;
+    LFORMALS(p) = lval_qexpr();
+    for (; i < LCOUNT(formals); i++) {
+        lval_add(LFORMALS(p), lval_ref(LCELL(formals)[i]));
+    }
+    LBODY(p) = lval_ref(LBODY(f));
+    *r = p;
+    return NULL;
+    
+}
+
+lval* lmemo_call(lenv*, lval*, int, lval**);
+
+/* "Call" an "lval" on borrowed arguments */
+lval* lval_call(lenv* e, lval* f, int argc, lval** argv) {
+    
+    /* If Builtin then simply apply that, through the cache of a memo */
+    if (LBUILTIN(f)) {
+        if (LMEMO(f)) { return lmemo_call(e, f, argc, argv); }
+        return LBUILTIN(f)(e, argc, argv);
+    }
+    
+    /* Bind the arguments, returning early unless all formals are bound */
+    lval* r;
+    lenv* frame = lval_bind(f, argc, argv, &r);
+    if (!frame) { return r; }
+    
+    /* Set enviroment parent to evaluation enviroment */
+    frame->par = e;
+    
+    /* Run the compiled body, which deletes the frame once done */
+    return lcode_run(frame, LBODY(f));
+}
+
+int comp_eq(double a, double b)
+{ return fabs(a - b) < 1e-9; }
+
+int lhamt_within(lhamt*, lval*);
+
+/* Equality operatoe */
+int lval_eq(lval* x, lval* y) {
+    
+    /* Different Types are always unequal */
+    if (LTYPE(x) != LTYPE(y)) { return 0; }
+    
+    /* Compare Based upon type */
+    switch (LTYPE(x)) {
+        /* Compare Number Value */
+        case LVAL_NUM: return (LNUM(x) == LNUM(y));
+        case LVAL_DNUM: return comp_eq(LDNUM(x), LDNUM(y));
+        
+        /* Compare String Values */
+        case LVAL_ERR: return (strcmp(LERR(x), LERR(y)) == 0);
+        case LVAL_SYM: return (LSYMID(x) == LSYMID(y));
+        case LVAL_STR: return (strcmp(LSTR(x), LSTR(y)) == 0);
+        
+        /* If builtin compare, otherwise compare formals and body */
+        case LVAL_FUN:
+            if (LBUILTIN(x) || LBUILTIN(y)) {
+                return LBUILTIN(x) == LBUILTIN(y) && LMEMO(x) == LMEMO(y);
+            } else {
+                return lval_eq(LFORMALS(x), LFORMALS(y)) &&
+                    lval_eq(LBODY(x), LBODY(y));
+            }
+        
+        /* If list compare every individual element */
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            if (LCOUNT(x) != LCOUNT(y)) { return 0; }
+            for (int i = 0; i < LCOUNT(x); i++) {
+                /* If any element not equal then whole list not equal */
+                if (!lval_eq(LCELL(x)[i], LCELL(y)[i])) { return 0; }
+            }
+            /* Otherwise lists must be equal */
+            return 1;
+        
+        /* Vectors of the same kind compare element by element */
+        case LVAL_VEC:
+            if (LVDBL(x) != LVDBL(y) || LVCOUNT(x) != LVCOUNT(y)) { return 0; }
+            for (int i = 0; i < LVCOUNT(x); i++) {
+                if (LVDBL(x) ? !comp_eq(LVDNUMS(x)[i], LVDNUMS(y)[i])
+                        : LVNUMS(x)[i] != LVNUMS(y)[i]) { return 0; }
+            }
+            return 1;
+        
+        /* Matrices of the same shape compare element by element */
+        case LVAL_MAT:
+            if (LMROWS(x) != LMROWS(y) || LMCOLS(x) != LMCOLS(y)) { return 0; }
+            for (size_t i = 0; i < (size_t)LMROWS(x) * LMCOLS(x); i++) {
+                if (!comp_eq(LMDATA(x)[i], LMDATA(y)[i])) { return 0; }
+            }
+            return 1;
+        
+        /* Arrays compare their slots like lists */
+        case LVAL_ARRAY:
+            if (LACOUNT(x) != LACOUNT(y)) { return 0; }
+            for (int i = 0; i < LACOUNT(x); i++) {
+                if (!lval_eq(LASLOT(x)[i], LASLOT(y)[i])) { return 0; }
+            }
+            return 1;
+        
+        /* Maps are equal if they have equal values for the same keys */
+        case LVAL_MAP:
+            return LHCOUNT(x) == LHCOUNT(y) && lhamt_within(LHROOT(x), y);
+    }
+    return 0;
+}
+
+/* Hashing */
+/* lval_hash gives equal hashes to two "lval"s lval_eq finds equal, but */
+/* for their Doubles. Doubles are equal within 1e-9 of each other, so a */
+/* Double is hashed by the quantum of LHASH_QUANTUM it is nearest, and */
+/* one equal to it may be nearest the quantum next to it instead. Only */
+/* the first LHASH_DNUMS Doubles of an "lval" are hashed, and lookups in */
+/* Maps try each mix of quantums those near an edge may have moved to. */
+/* A Map as a key hashes none of the Doubles it holds. */
+/* Arrays and Matrices hash what they hold at the time, so one that is */
+/* changed while it is a key of a Map will not be found again. */
+
+/* Width of a quantum, wide enough that Doubles 1e-9 apart are less */
+/* than a quarter of it apart once divided by it, rounding included. */
+/* From 2^23 on Doubles are more than 1e-9 apart, so are equal only if */
+/* the same. */
+#define LHASH_QUANTUM 8e-9
+#define LHASH_DNUMS 4
+
+/* Walk of the Doubles of an "lval" while hashing it */
+typedef struct {
+    unsigned alt;   /* Doubles to take the next quantum of, by bit */
+    unsigned edge;  /* Doubles near enough an edge to need it, by bit */
+    int dnums;      /* Doubles hashed so far */
+} lhash_walk;
+
+/* Spread the bits of "h", since the trie uses them five at a time */
+static inline unsigned long lhash_mix(unsigned long h) {
+    h ^= h >> 33;
+    h *= (unsigned long)0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Add "x" into the running hash "h" */
+static inline unsigned long lhash_add(unsigned long h, unsigned long x) {
+    return lhash_mix(h * 31 + x);
+}
+
+/* Add the Double "x" into the running hash "h" */
+static unsigned long lhash_dnum(lhash_walk* w, unsigned long h, double x) {
+    if (w->dnums >= LHASH_DNUMS) { return h; }
+    unsigned bit = 1u << w->dnums++;
+    
+    /* Past any rounding the Double itself is hashed */
+    double s = x / LHASH_QUANTUM;
+    if (!(fabs(s) < 0x1p62)) {
+        uint64_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        return lhash_add(h, bits);
+    }
+    
+    double q = floor(s + 0.5);
+    if (fabs(s - q) >= 0.25) {
+        w->edge |= bit;
+        if (w->alt & bit) { q += s >= q ? 1 : -1; }
+    }
+    return lhash_add(h, (unsigned long)(long)q);
+}
+
+unsigned long lhamt_hash(lhamt*);
+
+/* Hash an "lval" along the walk "w" of its Doubles */
+unsigned long lval_hash_walk(lval* v, lhash_walk* w) {
+    int t = LTYPE(v);
+    unsigned long h = lhash_mix(t + 1);
+    switch (t) {
+        case LVAL_NUM: return lhash_add(h, LNUM(v));
+        case LVAL_DNUM: return lhash_dnum(w, h, LDNUM(v));
+        case LVAL_ERR: return lhash_add(h, lsym_hash(LERR(v)));
+        case LVAL_SYM: return lhash_add(h, LSYMID(v)->hash);
+        case LVAL_STR: return lhash_add(h, lsym_hash(LSTR(v)));
+        
+        case LVAL_FUN:
+            if (LBUILTIN(v)) {
+                h = lhash_add(h, (uintptr_t)LMEMO(v));
+                return lhash_add(h, (uintptr_t)LBUILTIN(v));
+            }
+            h = lhash_add(h, lval_hash_walk(LFORMALS(v), w));
+            return lhash_add(h, lval_hash_walk(LBODY(v), w));
+        
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for (int i = 0; i < LCOUNT(v); i++) {
+                h = lhash_add(h, lval_hash_walk(LCELL(v)[i], w));
+            }
+            return h;
+        
+        case LVAL_VEC:
+            h = lhash_add(h, LVDBL(v));
+            h = lhash_add(h, LVCOUNT(v));
+            if (LVDBL(v)) {
+                for (int i = 0; i < LVCOUNT(v) && w->dnums < LHASH_DNUMS; i++) {
+                    h = lhash_dnum(w, h, LVDNUMS(v)[i]);
+                }
+                return h;
+            }
+            for (int i = 0; i < LVCOUNT(v); i++) { h = lhash_add(h, LVNUMS(v)[i]); }
+            return h;
+        
+        case LVAL_MAT:
+            h = lhash_add(h, LMROWS(v));
+            h = lhash_add(h, LMCOLS(v));
+            for (size_t i = 0; i < (size_t)LMROWS(v) * LMCOLS(v) &&
+                    w->dnums < LHASH_DNUMS; i++) {
+                h = lhash_dnum(w, h, LMDATA(v)[i]);
+            }
+            return h;
+        
+        case LVAL_ARRAY:
+            for (int i = 0; i < LACOUNT(v); i++) {
+                h = lhash_add(h, lval_hash_walk(LASLOT(v)[i], w));
+            }
+            return h;
+        
+        /* Keys come in no particular order, so their hashes are summed */
+        case LVAL_MAP: return lhash_add(h, lhamt_hash(LHROOT(v)));
+    }
+    return h;
+}
+
+/* Hash an "lval", taking the nearest quantum of each Double */
+unsigned long lval_hash(lval* v) {
+    lhash_walk w = { 0, 0, 0 };
+    return lval_hash_walk(v, &w);
+}
+
+/* Hash Array Mapped Trie */
+/* Updates copy only the nodes on the path to the key, sharing the rest */
+/* with the version they were made from. */
+
+/* Construct a pointer to a new node with room for "count" entries */
+lhamt* lhamt_new(int count) {
+    lhamt* n = malloc(sizeof(lhamt) + sizeof(lhent) * count);
+    n->rc = 1;
+    n->bitmap = 0;
+    n->count = count;
+    return n;
+}
+
+/* Delete a node once no version of a Map shares it */
+void lhamt_del(lhamt* n) {
+    if (!n || --n->rc > 0) { return; }
+    for (int i = 0; i < n->count; i++) {
+        if (n->ent[i].sub) {
+            lhamt_del(n->ent[i].sub);
+        } else {
+            lval_del(n->ent[i].key);
+            lval_del(n->ent[i].val);
+        }
+    }
+    free(n);
+}
+
+/* Share a node */
+static inline lhamt* lhamt_ref(lhamt* n) {
+    if (n) { n->rc++; }
+    return n;
+}
+
+/* Copy node "n", sharing its entries, with room made for a new entry */
+/* at "pos" if "grow" is 1, or the entry at "pos" dropped if it is -1, */
+/* or left to be replaced if it is 0. The new entry is left unset. */
+lhamt* lhamt_edit(lhamt* n, int pos, int grow) {
+    lhamt* c = lhamt_new((n ? n->count : 0) + grow);
+    c->bitmap = n ? n->bitmap : 0;
+    for (int i = 0; n && i < n->count; i++) {
+        if (i == pos && grow <= 0) { continue; }
+        lhent* x = &c->ent[i < pos ? i : i + grow];
+        *x = n->ent[i];
+        if (x->sub) {
+            x->sub->rc++;
+        } else {
+            lval_ref(x->key);
+            lval_ref(x->val);
+        }
+    }
+    return c;
+}
+
+/* Entry holding "k" and "v" */
+static inline lhent lhent_new(unsigned long h, lval* k, lval* v) {
+    lhent x = { h, lval_ref(k), lval_ref(v), NULL };
+    return x;
+}
+
+/* Position of the hash "h" in a node at "shift", and its bit */
+#define LHAMT_BIT(h, shift) ((uint32_t)1 << (((h) >> (shift)) & 31))
+#define LHAMT_POS(n, bit) (__builtin_popcount((n)->bitmap & ((bit) - 1)))
+
+/* Value of the key "k" with hash "h" under node "n", or NULL */
+lval* lhamt_get(lhamt* n, unsigned long h, lval* k) {
+    for (int shift = 0; n; shift += LHAMT_BITS) {
+        /* Past the end of the hash every key shares it */
+        if (shift >= LHAMT_HASH_BITS) {
+            for (int i = 0; i < n->count; i++) {
+                if (lval_eq(n->ent[i].key, k)) { return n->ent[i].val; }
+            }
+            return NULL;
+        }
+        uint32_t bit = LHAMT_BIT(h, shift);
+        if (!(n->bitmap & bit)) { return NULL; }
+        lhent* x = &n->ent[LHAMT_POS(n, bit)];
+        if (!x->sub) {
+            return x->hash == h && lval_eq(x->key, k) ? x->val : NULL;
+        }
+        n = x->sub;
+    }
+    return NULL;
+}
+
+/* New version of node "n" at "shift" with "k" bound to "v", setting */
+/* "added" if "k" was not there before */
+lhamt* lhamt_assoc(lhamt* n, int shift, unsigned long h, lval* k, lval* v,
+        int* added) {
+    
+    /* Keys sharing the whole hash are replaced or appended */
+    if (shift >= LHAMT_HASH_BITS) {
+        for (int i = 0; n && i < n->count; i++) {
+            if (!lval_eq(n->ent[i].key, k)) { continue; }
+            lhamt* c = lhamt_edit(n, i, 0);
+            c->ent[i] = lhent_new(h, k, v);
+            return c;
+        }
+        int end = n ? n->count : 0;
+        lhamt* c = lhamt_edit(n, end, 1);
+        c->ent[end] = lhent_new(h, k, v);
+        *added = 1;
+        return c;
+    }
+    
+    /* A free position takes the key */
+    uint32_t bit = LHAMT_BIT(h, shift);
+    int pos = n ? LHAMT_POS(n, bit) : 0;
+    if (!n || !(n->bitmap & bit)) {
+        lhamt* c = lhamt_edit(n, pos, 1);
+        c->bitmap |= bit;
+        c->ent[pos] = lhent_new(h, k, v);
+        *added = 1;
+        return c;
+    }
+    
+    lhent* x = &n->ent[pos];
+    lhamt* sub;
+    if (x->sub) {
+        sub = lhamt_assoc(x->sub, shift + LHAMT_BITS, h, k, v, added);
+    } else if (x->hash == h && lval_eq(x->key, k)) {
+        lhamt* c = lhamt_edit(n, pos, 0);
+        c->ent[pos] = lhent_new(h, k, v);
+        return c;
+    } else {
+        /* A different key there moves down with the new one */
+        int unused = 0;
+        lhamt* one = lhamt_assoc(NULL, shift + LHAMT_BITS,
+                x->hash, x->key, x->val, &unused);
+        sub = lhamt_assoc(one, shift + LHAMT_BITS, h, k, v, added);
+        lhamt_del(one);
+    }
+    lhamt* c = lhamt_edit(n, pos, 0);
+    c->ent[pos] = (lhent){ 0, NULL, NULL, sub };
+    return c;
+}
+
+/* New version of node "n" at "shift" without "k", setting "removed" */
+/* if it was there. Gives NULL for a node left empty, and "n" itself */
+/* shared once more if nothing changed. */
+lhamt* lhamt_dissoc(lhamt* n, int shift, unsigned long h, lval* k,
+        int* removed) {
+    if (!n) { return NULL; }
+    
+    int pos = -1;
+    uint32_t bit = 0;
+    if (shift >= LHAMT_HASH_BITS) {
+        for (int i = 0; i < n->count; i++) {
+            if (lval_eq(n->ent[i].key, k)) { pos = i; break; }
+        }
+        if (pos < 0) { return lhamt_ref(n); }
+        *removed = 1;
+    } else {
+        bit = LHAMT_BIT(h, shift);
+        if (!(n->bitmap & bit)) { return lhamt_ref(n); }
+        pos = LHAMT_POS(n, bit);
+        lhent* x = &n->ent[pos];
+        
+        if (x->sub) {
+            lhamt* sub = lhamt_dissoc(x->sub, shift + LHAMT_BITS, h, k, removed);
+            if (sub == x->sub) { lhamt_del(sub); return lhamt_ref(n); }
+            if (sub) {
+                lhamt* c = lhamt_edit(n, pos, 0);
+                if (sub->count == 1 && !sub->ent[0].sub) {
+                    /* A single key left below moves up in its place */
+                    lhent y = sub->ent[0];
+                    c->ent[pos] = lhent_new(y.hash, y.key, y.val);
+                    lhamt_del(sub);
+                } else {
+                    c->ent[pos] = (lhent){ 0, NULL, NULL, sub };
+                }
+                return c;
+            }
+        } else if (x->hash != h || !lval_eq(x->key, k)) {
+            return lhamt_ref(n);
+        } else {
+            *removed = 1;
+        }
+    }
+    
+    /* Drop the entry at "pos" */
+    if (n->count == 1) { return NULL; }
+    lhamt* c = lhamt_edit(n, pos, -1);
+    c->bitmap &= ~bit;
+    return c;
+}
+
+/* Value of a key equal to "k" under node "n", or NULL, with "h" set to */
+/* the hash it is under, or else to the hash of "k" itself. Each mix of */
+/* quantums the Doubles of "k" near an edge could share with an equal */
+/* key is tried in turn. */
+lval* lhamt_find(lhamt* n, lval* k, unsigned long* h) {
+    lhash_walk w = { 0, 0, 0 };
+    unsigned long first = *h = lval_hash_walk(k, &w);
+    lval* v = lhamt_get(n, first, k);
+    unsigned edge = w.edge;
+    for (unsigned alt = edge; !v && alt; alt = (alt - 1) & edge) {
+        lhash_walk a = { alt, 0, 0 };
+        *h = lval_hash_walk(k, &a);
+        v = lhamt_get(n, *h, k);
+    }
+    if (!v) { *h = first; }
+    return v;
+}
+
+/* Whether every key under node "n" has an equal value in the Map "m" */
+int lhamt_within(lhamt* n, lval* m) {
+    for (int i = 0; n && i < n->count; i++) {
+        lhent* x = &n->ent[i];
+        if (x->sub) {
+            if (!lhamt_within(x->sub, m)) { return 0; }
+            continue;
+        }
+        unsigned long h;
+        lval* y = lhamt_find(LHROOT(m), x->key, &h);
+        if (!y || !lval_eq(x->val, y)) { return 0; }
+    }
+    return 1;
+}
+
+/* Sum of the hashes of the keys and values under node "n", leaving */
+/* out their Doubles */
+unsigned long lhamt_hash(lhamt* n) {
+    unsigned long h = 0;
+    for (int i = 0; n && i < n->count; i++) {
+        lhent* x = &n->ent[i];
+        if (x->sub) { h += lhamt_hash(x->sub); continue; }
+        lhash_walk w = { 0, 0, LHASH_DNUMS };
+        unsigned long k = lval_hash_walk(x->key, &w);
+        h += lhash_add(k, lval_hash_walk(x->val, &w));
+    }
+    return h;
+}
+
+#define LASSERT(cond, err, ...) \
+    if (!(cond)) { return lval_err(err, ##__VA_ARGS__); }
+
+#define LASSERT_FUN(fun) \
+    LASSERT(argc == 1,\
+            "Function '" #fun "' passed incorrect number of arguments. "\
+            "Got %i, Expected %i.",\
+            argc, 1);\
+    LASSERT(LTYPE(argv[0]) == LVAL_QEXPR,\
+            "Function '" #fun "' passed incorrect type for argument 0. "\
+            "Got %s, Expected %s.",\
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_QEXPR))
+#define LASSERT_NEMPTY(fun) \
+    LASSERT(LCOUNT(argv[0]) != 0,\
+            "Function '" #fun "' passed {}!")
+
+
+/* Builtin function head */
+lval* builtin_head(lenv* e, int argc, lval** argv) {
+    LASSERT_FUN(head);
+    LASSERT_NEMPTY(head);
+    
+    return lval_add(lval_qexpr(), lval_ref(LCELL(argv[0])[0]));
+}
+
+/* Builtin function tail */
+lval* builtin_tail(lenv* e, int argc, lval** argv) {
+    LASSERT_FUN(tail);
+    LASSERT_NEMPTY(tail);
+    
+    /* Share every element after the first */
+    return lval_slice(argv[0], 1, LCOUNT(argv[0]));
+}
+
+/* Builtin function list */
+lval* builtin_list(lenv* e, int argc, lval** argv) {
+    lval* v = lval_qexpr();
+    LCAP(v) = lpool_cap(argc);
+    LCELL(v) = (lval**)lpool_array(LCAP(v));
+    for (int i = 0; i < argc; i++) {
+        LCELL(v)[LCOUNT(v)++] = lval_ref(argv[i]);
+    }
+    return v;
+}
+
+/* Builtin function eval */
+lval* builtin_eval(lenv* e, int argc, lval** argv) {
+    LASSERT_FUN(eval);
+    
+    /* Evaluate the Q-Expression as an S-Expression in place */
+    return lval_eval_sexpr(e, argv[0]);
+}
+
+/* Builtin function join */
+lval* builtin_join(lenv* e, int argc, lval** argv) {
+    
+    int count = 0;
+    for (int i = 0; i < argc; i++) {
+        LASSERT(LTYPE(argv[i]) == LVAL_QEXPR,
+                "Function 'join' passed incorrect type for argument %i. "
+                "Got %s, Expected %s",
+                i, ltype_name(LTYPE(argv[i])), ltype_name(LVAL_QEXPR));
+        count += LCOUNT(argv[i]);
+    }
+    
+    if (argc == 2) {
+        lval* x = argv[0];
+        lval* y = argv[1];
+        
+        /* Joining an empty list changes nothing */
+        if (LCOUNT(x) == 0) { return lval_ref(y); }
+        if (LCOUNT(y) == 0) { return lval_ref(x); }
+        
+        /* Grow "y" to the front if it starts where its buffer does */
+        lvec* b = LVEC(y);
+        if (b && LCELL(y) == b->cell + b->lo && b->lo >= LCOUNT(x)) {
+            for (int i = LCOUNT(x) - 1; i >= 0; i--) {
+                b->cell[--b->lo] = lval_ref(LCELL(x)[i]);
+            }
+            return lval_view(LVAL_QEXPR, b, b->cell + b->lo, count);
+        }
+        
+        /* Grow "x" to the back if it ends where its buffer does */
+        b = LVEC(x);
+        if (b && LCELL(x) + LCOUNT(x) == b->cell + b->hi &&
+                b->cap - b->hi >= LCOUNT(y)) {
+            for (int i = 0; i < LCOUNT(y); i++) {
+                b->cell[b->hi++] = lval_ref(LCELL(y)[i]);
+            }
+            return lval_view(LVAL_QEXPR, b, LCELL(x), count);
+        }
+    }
+    
+    /* Share the elements of every list into a new buffer with as much */
+    /* room again split between its two ends */
+    lvec* b = lvec_new(count * 2, count / 2);
+    for (int i = 0; i < argc; i++) {
+        for (int j = 0; j < LCOUNT(argv[i]); j++) {
+            b->cell[b->hi++] = lval_ref(LCELL(argv[i])[j]);
+        }
+    }
+    return lval_view(LVAL_QEXPR, b, b->cell + b->lo, count);
+}
+
+/* Arithmetic Kernels */
+/* Each operator reduces its arguments in a loop of its own for Numbers */
+/* and another for Doubles, picked once per call instead of comparing */
+/* the operator's name at every element. Number kernels report overflow */
+/* as an error rather than wrapping around. */
+typedef lval* (*lkernel)(int, lval**);
+
+/* Checked operations on two longs, nonzero if "r" would not hold it */
+#define lnum_add(x, y, r) __builtin_add_overflow(x, y, r)
+#define lnum_sub(x, y, r) __builtin_sub_overflow(x, y, r)
+#define lnum_mul(x, y, r) __builtin_mul_overflow(x, y, r)
+
+/* Division of the least long by -1 is the one that overflows */
+static inline int lnum_div(long x, long y, long* r) {
+    if (x == LONG_MIN && y == -1) { return 1; }
+    *r = x / y;
+    return 0;
+}
+
+/* Kernels for an operator whose "guard" must hold of each operand "y" */
+#define LKERNEL_ARITH(name, opr, checked, guard) \
+    static inline lval* lkernel_##name(int argc, lval** argv) { \
+        long r = LNUM(argv[0]); \
+        for (int i = 1; i < argc; i++) { \
+            long y = LNUM(argv[i]); \
+            if (!(guard)) { return lval_err("Division By Zero!"); } \
+            if (checked(r, y, &r)) { \
+                return lval_err("Integer overflow in '" #opr "'."); \
+            } \
+        } \
+        return lval_num(r); \
+    } \
+    static inline lval* lkernel_##name##_double(int argc, lval** argv) { \
+        double r = LDNUM(argv[0]); \
+        for (int i = 1; i < argc; i++) { r = r opr LDNUM(argv[i]); } \
+        return lval_dnum(r); \
+    }
+
+LKERNEL_ARITH(add, +, lnum_add, 1)
+LKERNEL_ARITH(sub, -, lnum_sub, 1)
+LKERNEL_ARITH(mul, *, lnum_mul, 1)
+LKERNEL_ARITH(div, /, lnum_div, y != 0)
+
+/* Eval operators on an "lval" with the kernels for Numbers and Doubles */
+lval* builtin_op(lenv* e, int argc, lval** argv, char* op,
+        lkernel num, lkernel dnum) {
+    
+    /* Two Numbers or two Doubles go straight to the kernel */
+    if (argc == 2 && LTYPE(argv[0]) == LTYPE(argv[1])) {
+        if (LTYPE(argv[0]) == LVAL_NUM) { return num(argc, argv); }
+        if (LTYPE(argv[0]) == LVAL_DNUM) { return dnum(argc, argv); }
+    }
+    
+    int double_t = LVAL_NUM;
+    if (LTYPE(argv[0]) == LVAL_DNUM) double_t = LVAL_DNUM;
+    
+    /* Ensure all arguments are numbers */
+    for (int i = 0; i < argc; i++) {
+        LASSERT(LTYPE(argv[i]) == double_t,
+                "Function '%s' passed incorrect type for argument %i. "
+                "Got %s, Expected %s.",
+                op, i, ltype_name(LTYPE(argv[i])), ltype_name(double_t));
+    }
+    
+    return double_t == LVAL_DNUM ? dnum(argc, argv) : num(argc, argv);
+}
+
+/* Builtin operator functions */
+lval* builtin_add(lenv* e, int argc, lval** argv) {
+    return builtin_op(e, argc, argv, "+", lkernel_add, lkernel_add_double);
+}
+
+lval* builtin_sub(lenv* e, int argc, lval** argv) {
+    /* If no arguments after the first then perform unary negation */
+    if (argc == 1 && LTYPE(argv[0]) == LVAL_NUM) {
+        long r;
+        if (lnum_sub(0, LNUM(argv[0]), &r)) {
+            return lval_err("Integer overflow in '-'.");
+        }
+        return lval_num(r);
+    }
+    if (argc == 1 && LTYPE(argv[0]) == LVAL_DNUM) {
+        return lval_dnum(-LDNUM(argv[0]));
+    }
+    return builtin_op(e, argc, argv, "-", lkernel_sub, lkernel_sub_double);
+}
+
+lval* builtin_mul(lenv* e, int argc, lval** argv) {
+    return builtin_op(e, argc, argv, "*", lkernel_mul, lkernel_mul_double);
+}
+
+lval* builtin_div(lenv* e, int argc, lval** argv) {
+    return builtin_op(e, argc, argv, "/", lkernel_div, lkernel_div_double);
+}
+
+/* Define a variable */
+lval* builtin_var(lenv* e, int argc, lval** argv, char* func) {
+    LASSERT(LTYPE(argv[0]) == LVAL_QEXPR,
+            "Function '%s' passed incorrect type for argument 0. "
+            "Got %s, Expected %s.", func,
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_QEXPR));
+    
+    /* First argument is symbol list */
+    lval* syms = argv[0];
+    
+    /* Ensure all elements of first list are symbols */
+    for (int i = 0; i < LCOUNT(syms); i++) {
+        LASSERT(LTYPE(LCELL(syms)[i]) == LVAL_SYM,
+                "Function '%s' passed incorrect type for the %ith element in argument 1. "
+                "Got %s, Expected %s", func,
+                i, ltype_name(LTYPE(LCELL(syms)[i])), ltype_name(LVAL_SYM));
+    }
+    
+    /* Check correct number of symbols and values */
+    LASSERT(LCOUNT(syms) == argc - 1,
+            "Function '%s' cannot varine incorrect number of values to symbols. "
+            "Got %i and %i, Expected them to be equal.", func,
+            LCOUNT(syms), argc - 1);
+    
+    /* Assign copies of values to symbols */
+    for (int i = 0; i < LCOUNT(syms); i++) {
+        /* If 'def' define in globally. */
+        if (strcmp(func, "def") == 0) {
+            lenv_def(e, LCELL(syms)[i], argv[i + 1]);
+        }
+        
+        /* If 'put' define in locally */
+        if (strcmp(func, "=") == 0) {
+            lenv_put(e, LCELL(syms)[i], argv[i + 1]);
+        }
+    }
+    
+    return lval_sexpr();
+}
+
+lval* builtin_def(lenv* e, int argc, lval** argv) {
+    return builtin_var(e, argc, argv, "def");
+}
+
+lval* builtin_put(lenv* e, int argc, lval** argv) {
+    return builtin_var(e, argc, argv, "=");
+}
+
+/* Define a lambda */
+lval* builtin_lambda(lenv* e, int argc, lval** argv) {
+    /* Check Two arguments, each of which are Q-Expressions */
+    LASSERT(argc == 2,
+            "Function \\ passed incorrect number of arguments. "
+            "Got %i, Expected 2.",
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_QEXPR,
+            "Function \\ passed incorrect type for argument 0. "
+            "Got %s, Expected %s.",
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_QEXPR));
+    LASSERT(LTYPE(argv[1]) == LVAL_QEXPR,
+            "Function \\ passed incorrect type for argument 1. "
+            "Got %s, Expected %s.",
+            ltype_name(LTYPE(argv[1])), ltype_name(LVAL_QEXPR));
+    
+    /* Check first Q-Expression contains only Symbols */
+    for (int i = 0; i < LCOUNT(argv[0]); i++) {
+        LASSERT((LTYPE(LCELL(argv[0])[i]) == LVAL_SYM),
+                "Function \\ passed incorrect type for the %ith element of argument 0. "
+                "Got %s, Expected %s.",
+                i, ltype_name(LTYPE(LCELL(argv[0])[i])), ltype_name(LVAL_SYM));
+    }
+    
+    /* Share the two arguments with lval_lambda */
+    return lval_lambda(lval_ref(argv[0]), lval_ref(argv[1]));
+}
+
+/* Ordering Kernels */
+/* Orderings give a Number for Numbers and a Double for Doubles */
+/* Doubles within 1e-9 of each other count as equal when "deq" is set */
+#define LKERNEL_ORD(name, opr, dopr, deq) \
+    static inline lval* lkernel_##name(int argc, lval** argv) { \
+        return lval_num(LNUM(argv[0]) opr LNUM(argv[1])); \
+    } \
+    static inline lval* lkernel_##name##_double(int argc, lval** argv) { \
+        double x = LDNUM(argv[0]); \
+        double y = LDNUM(argv[1]); \
+        return lval_dnum(x dopr y || ((deq) && comp_eq(x, y))); \
+    }
+
+LKERNEL_ORD(gt, >, >, 0)
+LKERNEL_ORD(lt, <, <, 0)
+LKERNEL_ORD(ge, >=, >, 1)
+LKERNEL_ORD(le, <=, <, 1)
+
+/* Compare two "lval"s with the kernels for Numbers and Doubles */
+lval* builtin_ord(lenv* e, int argc, lval** argv, char* op,
+        lkernel num, lkernel dnum) {
+    /* Check Two arguments, each of which are Numbers */
+    LASSERT(argc == 2,
+            "Function %s passed incorrect number of arguments. "
+            "Got %i, Expected 2.", op, 
+            argc);
+    
+    /* Two Numbers or two Doubles go straight to the kernel */
+    if (LTYPE(argv[0]) == LTYPE(argv[1])) {
+        if (LTYPE(argv[0]) == LVAL_NUM) { return num(argc, argv); }
+        if (LTYPE(argv[0]) == LVAL_DNUM) { return dnum(argc, argv); }
+    }
+    
+    LASSERT(LTYPE(argv[0]) == LVAL_NUM || LTYPE(argv[0]) == LVAL_DNUM,
+            "Function %s passed incorrect type for argument 0. "
+            "Got %s, Expected %s or %s.", op, 
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_NUM), ltype_name(LVAL_DNUM));
+    LASSERT(LTYPE(argv[1]) == LVAL_NUM || LTYPE(argv[1]) == LVAL_DNUM,
+            "Function %s passed incorrect type for argument 1. "
+            "Got %s, Expected %s or %s.", op, 
+            ltype_name(LTYPE(argv[1])), ltype_name(LVAL_NUM), ltype_name(LVAL_DNUM));
+    return lval_err("Function %s passed unequal type for argument 0 and 1. "
+            "Got %s and %s, Expect them to be equal.", op,
+            ltype_name(LTYPE(argv[0])), ltype_name(LTYPE(argv[1])));
+}
+
+/* Builtin Ordering Operators */
+lval* builtin_gt(lenv* e, int argc, lval** argv) {
+    return builtin_ord(e, argc, argv, ">", lkernel_gt, lkernel_gt_double);
+}
+lval* builtin_lt(lenv* e, int argc, lval** argv) {
+    return builtin_ord(e, argc, argv, "<", lkernel_lt, lkernel_lt_double);
+}
+lval* builtin_ge(lenv* e, int argc, lval** argv) {
+    return builtin_ord(e, argc, argv, ">=", lkernel_ge, lkernel_ge_double);
+}
+lval* builtin_le(lenv* e, int argc, lval** argv) {
+    return builtin_ord(e, argc, argv, "<=", lkernel_le, lkernel_le_double);
+}
+
+/* Equality comparison, giving "eq" when the two are equal */
+lval* builtin_cmp(lenv* e, int argc, lval** argv, char* op, int eq) {
+    LASSERT(argc == 2,
+            "Function %s passed incorrect number of arguments. "
+            "Got %i, Expected 2.", op, 
+            argc);
+    return lval_num(lval_eq(argv[0], argv[1]) ? eq : !eq);
+}
+
+/* Equality builtin operators */
+lval* builtin_eq(lenv* e, int argc, lval** argv) {
+    return builtin_cmp(e, argc, argv, "==", 1);
+}
+
+lval* builtin_ne(lenv* e, int argc, lval** argv) {
+    return builtin_cmp(e, argc, argv, "!=", 0);
+}
+
+/* If expression */
+lval* builtin_if(lenv* e, int argc, lval** argv) {
+    /* Check Three arguments, each of which are Numbers, and two Q-expression */
+    LASSERT(argc == 3,
+            "Function if passed incorrect number of arguments. "
+            "Got %i, Expected 3.",
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_NUM,
+            "Function if passed incorrect type for argument 0. "
+            "Got %s, Expected %s.",
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_NUM));
+    LASSERT(LTYPE(argv[1]) == LVAL_QEXPR,
+            "Function if passed incorrect type for argument 1. "
+            "Got %s, Expected %s.",
+            ltype_name(LTYPE(argv[1])), ltype_name(LVAL_QEXPR));
+    LASSERT(LTYPE(argv[2]) == LVAL_QEXPR,
+            "Function if passed incorrect type for argument 2. "
+            "Got %s, Expected %s.",
+            ltype_name(LTYPE(argv[2])), ltype_name(LVAL_QEXPR));
+    
+    /* Evaluate the chosen branch as an S-Expression in place */
+    lval* x;
+    if (LNUM(argv[0])) {
+        /* If condition is true evaluate first expression */
+        x = lval_eval_sexpr(e, argv[1]);
+    } else {
+        /* Otherwise evaluate second expression */
+        x = lval_eval_sexpr(e, argv[2]);
+    }
+    
+    return x;
+}
+
+/* Prelude List Functions */
+/* Each takes one pass over its list, doing what the recursive version */
+/* in the prelude did. Elements are evaluated wherever the prelude took */
+/* them with fst, and lambdas are called on them with lval_call. */
+
+#define LASSERT_ARGC(fun, n) \
+    LASSERT(argc == (n), \
+            "Function '" #fun "' passed incorrect number of arguments. " \
+            "Got %i, Expected %i.", \
+            argc, n)
+#define LASSERT_TYPE(fun, i, t) \
+    LASSERT(LTYPE(argv[i]) == (t), \
+            "Function '" #fun "' passed incorrect type for argument %i. " \
+            "Got %s, Expected %s.", \
+            i, ltype_name(LTYPE(argv[i])), ltype_name(t))
+
+/* Length */
+lval* builtin_len(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(len, 1);
+    LASSERT_TYPE(len, 0, LVAL_QEXPR);
+    
+    return lval_num(LCOUNT(argv[0]));
+}
+
+/* Nth, evaluated */
+lval* builtin_nth(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(nth, 2);
+    LASSERT_TYPE(nth, 0, LVAL_NUM);
+    LASSERT_TYPE(nth, 1, LVAL_QEXPR);
+    LASSERT(LNUM(argv[0]) >= 0 && LNUM(argv[0]) < LCOUNT(argv[1]),
+            "Function 'nth' passed index %li of a list of %i.",
+            LNUM(argv[0]), LCOUNT(argv[1]));
+    
+    return lval_eval(e, LCELL(argv[1])[LNUM(argv[0])]);
+}
+
+/* Last, evaluated */
+lval* builtin_last(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(last, 1);
+    LASSERT_TYPE(last, 0, LVAL_QEXPR);
+    LASSERT(LCOUNT(argv[0]) != 0, "Function 'last' passed {}!");
+    
+    return lval_eval(e, LCELL(argv[0])[LCOUNT(argv[0]) - 1]);
+}
+
+/* Check the arguments of take, drop and split */
+#define LASSERT_SPLIT(fun) \
+    LASSERT_ARGC(fun, 2); \
+    LASSERT_TYPE(fun, 0, LVAL_NUM); \
+    LASSERT_TYPE(fun, 1, LVAL_QEXPR); \
+    LASSERT(LNUM(argv[0]) >= 0 && LNUM(argv[0]) <= LCOUNT(argv[1]), \
+            "Function '" #fun "' passed %li of a list of %i.", \
+            LNUM(argv[0]), LCOUNT(argv[1]))
+
+/* Take N */
+lval* builtin_take(lenv* e, int argc, lval** argv) {
+    LASSERT_SPLIT(take);
+    
+    return lval_slice(argv[1], 0, LNUM(argv[0]));
+}
+
+/* Drop N */
+lval* builtin_drop(lenv* e, int argc, lval** argv) {
+    LASSERT_SPLIT(drop);
+    
+    if (LNUM(argv[0]) == 0) { return lval_ref(argv[1]); }
+    return lval_slice(argv[1], LNUM(argv[0]), LCOUNT(argv[1]));
+}
+
+/* Split at N */
+lval* builtin_split(lenv* e, int argc, lval** argv) {
+    LASSERT_SPLIT(split);
+    
+    lval* v = lval_qexpr();
+    lval_add(v, lval_slice(argv[1], 0, LNUM(argv[0])));
+    lval_add(v, lval_slice(argv[1], LNUM(argv[0]), LCOUNT(argv[1])));
+    return v;
+}
+
+/* Element of, comparing with each element evaluated */
+lval* builtin_elem(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(elem, 2);
+    LASSERT_TYPE(elem, 1, LVAL_QEXPR);
+    
+    lval* x = argv[0];
+    lval* l = argv[1];
+    for (int i = 0; i < LCOUNT(l); i++) {
+        lval* y = lval_eval(e, LCELL(l)[i]);
+        if (LTYPE(y) == LVAL_ERR) { return y; }
+        int eq = lval_eq(x, y);
+        lval_del(y);
+        if (eq) { return lval_num(1); }
+    }
+    return lval_num(0);
+}
+
+/* Reverse */
+lval* builtin_reverse(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(reverse, 1);
+    LASSERT_TYPE(reverse, 0, LVAL_QEXPR);
+    
+    lval* l = argv[0];
+    lvec* b = lvec_new(LCOUNT(l), 0);
+    for (int i = LCOUNT(l) - 1; i >= 0; i--) {
+        b->cell[b->hi++] = lval_ref(LCELL(l)[i]);
+    }
+    return lval_view(LVAL_QEXPR, b, b->cell, LCOUNT(l));
+}
+
+/* Apply Function to List */
+lval* builtin_map(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(map, 2);
+    LASSERT_TYPE(map, 0, LVAL_FUN);
+    LASSERT_TYPE(map, 1, LVAL_QEXPR);
+    
+    /* The arguments may move once anything is called */
+    lval* f = argv[0];
+    lval* l = argv[1];
+    
+    /* The result fills a buffer of the final size as it goes */
+    lvec* b = lvec_new(LCOUNT(l), 0);
+    lval* v = lval_view(LVAL_QEXPR, b, b->cell, 0);
+    for (int i = 0; i < LCOUNT(l); i++) {
+        lval* x = lval_eval(e, LCELL(l)[i]);
+        if (LTYPE(x) == LVAL_ERR) { lval_del(v); return x; }
+        lval* y = lval_call(e, f, 1, &x);
+        lval_del(x);
+        if (LTYPE(y) == LVAL_ERR) { lval_del(v); return y; }
+        b->cell[b->hi++] = y;
+        LCOUNT(v)++;
+    }
+    return v;
+}
+
+/* Apply Fliter to List, keeping the elements as they were */
+lval* builtin_fliter(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(fliter, 2);
+    LASSERT_TYPE(fliter, 0, LVAL_FUN);
+    LASSERT_TYPE(fliter, 1, LVAL_QEXPR);
+    
+    /* The arguments may move once anything is called */
+    lval* f = argv[0];
+    lval* l = argv[1];
+    
+    lvec* b = lvec_new(LCOUNT(l), 0);
+    lval* v = lval_view(LVAL_QEXPR, b, b->cell, 0);
+    for (int i = 0; i < LCOUNT(l); i++) {
+        lval* x = lval_eval(e, LCELL(l)[i]);
+        if (LTYPE(x) == LVAL_ERR) { lval_del(v); return x; }
+        lval* c = lval_call(e, f, 1, &x);
+        lval_del(x);
+        if (LTYPE(c) == LVAL_ERR) { lval_del(v); return c; }
+        if (LTYPE(c) != LVAL_NUM) {
+            lval* err = lval_err("Function 'fliter' got incorrect type from the function. "
+                    "Got %s, Expected %s.",
+                    ltype_name(LTYPE(c)), ltype_name(LVAL_NUM));
+            lval_del(c); lval_del(v);
+            return err;
+        }
+        if (LNUM(c)) {
+            b->cell[b->hi++] = lval_ref(LCELL(l)[i]);
+            LCOUNT(v)++;
+        }
+        lval_del(c);
+    }
+    return v;
+}
+
+/* Fold the elements of "l" into "z" with "f" from the left */
+/* "f" takes the element first if "flip" is set, as foldr does */
+lval* lval_fold(lenv* e, lval* f, lval* z, lval* l, int flip) {
+    lval* acc = lval_ref(z);
+    for (int i = 0; i < LCOUNT(l); i++) {
+        lval* x = lval_eval(e, LCELL(l)[i]);
+        if (LTYPE(x) == LVAL_ERR) { lval_del(acc); return x; }
+        lval* args[2] = { flip ? x : acc, flip ? acc : x };
+        lval* r = lval_call(e, f, 2, args);
+        lval_del(acc); lval_del(x);
+        if (LTYPE(r) == LVAL_ERR) { return r; }
+        acc = r;
+    }
+    return acc;
+}
+
+/* Fold left */
+lval* builtin_foldl(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(foldl, 3);
+    LASSERT_TYPE(foldl, 0, LVAL_FUN);
+    LASSERT_TYPE(foldl, 2, LVAL_QEXPR);
+    
+    return lval_fold(e, argv[0], argv[1], argv[2], 0);
+}
+
+/* Fold right, which like the prelude's also runs from the left */
+lval* builtin_foldr(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(foldr, 3);
+    LASSERT_TYPE(foldr, 0, LVAL_FUN);
+    LASSERT_TYPE(foldr, 2, LVAL_QEXPR);
+    
+    return lval_fold(e, argv[0], argv[1], argv[2], 1);
+}
+
+/* Sum and Product, folding with + and * from 0 and 1 */
+lval* builtin_sum(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(sum, 1);
+    LASSERT_TYPE(sum, 0, LVAL_QEXPR);
+    
+    lval* f = lval_fun(builtin_add);
+    lval* r = lval_fold(e, f, lval_num(0), argv[0], 0);
+    lval_del(f);
+    return r;
+}
+
+lval* builtin_product(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(product, 1);
+    LASSERT_TYPE(product, 0, LVAL_QEXPR);
+    
+    lval* f = lval_fun(builtin_mul);
+    lval* r = lval_fold(e, f, lval_num(1), argv[0], 0);
+    lval_del(f);
+    return r;
+}
+
+/* Vector Kernels */
+/* Loops over the packed data of Vectors. Every kernel has a portable */
+/* version and most have an AVX2 one too, and lsimd_init picks one set */
+/* once by asking the CPU. Folds over Doubles keep four running lanes in */
+/* both versions so they give the same result whichever set is used. */
+/* Number sums count how often the wrapped sum carried out of a long, */
+/* so they only report overflow when the whole sum does not fit. */
+
+/* Elementwise kernels read "x" and "y" at every index if "sx" and "sy" */
+/* are set, or else broadcast their first element. One of them is set. */
+typedef void (*lsimd_map)(double*, double*, int, double*, int, int);
+typedef int (*lsimd_map_num)(long*, long*, int, long*, int, int);
+
+/* Matrix product kernels add "kc" steps of "a" times "b" into a tile of */
+/* LSIMD_TILE_ROWS by LSIMD_TILE_COLS elements of "c". Each matrix is */
+/* passed with the distance between its rows. */
+#define LSIMD_TILE_ROWS 4
+#define LSIMD_TILE_COLS 8
+typedef void (*lsimd_tile)(double*, int, double*, int, double*, int, int);
+
+/* Declare New lsimd Struct, one set of kernels */
+typedef struct lsimd {
+    double (*sum)(double*, int);
+    double (*prod)(double*, int);
+    double (*min)(double*, int);
+    double (*max)(double*, int);
+    double (*dot)(double*, double*, int);
+    int (*sum_num)(long*, int, long*);
+    long (*min_num)(long*, int);
+    long (*max_num)(long*, int);
+    /* Elementwise + - * / in that order */
+    lsimd_map map[4];
+    lsimd_map_num map_num[4];
+    lsimd_tile tile;
+    /* First bracket, quote, semicolon or newline of some text */
+    const char* (*scan)(const char*, const char*);
+} lsimd;
+
+/* Fold Doubles with "opr" in four lanes, then the lanes and the rest */
+#define LSIMD_FOLD(name, init, opr) \
+    double lsimd_##name(double* x, int n) { \
+        double r[4] = { init, init, init, init }; \
+        int i = 0; \
+        for (; i + 4 <= n; i += 4) { \
+            for (int k = 0; k < 4; k++) { r[k] = r[k] opr x[i + k]; } \
+        } \
+        double t = (r[0] opr r[1]) opr (r[2] opr r[3]); \
+        for (; i < n; i++) { t = t opr x[i]; } \
+        return t; \
+    }
+
+LSIMD_FOLD(sum, 0.0, +)
+LSIMD_FOLD(prod, 1.0, *)
+
+double lsimd_dot(double* x, double* y, int n) {
+    double r[4] = { 0.0, 0.0, 0.0, 0.0 };
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int k = 0; k < 4; k++) { r[k] = r[k] + x[i + k] * y[i + k]; }
+    }
+    double t = (r[0] + r[1]) + (r[2] + r[3]);
+    for (; i < n; i++) { t = t + x[i] * y[i]; }
+    return t;
+}
+
+/* Least or greatest of "n" elements, "n" being at least one */
+#define LSIMD_PICK(name, type, cmp) \
+    type lsimd_##name(type* x, int n) { \
+        type r = x[0]; \
+        for (int i = 1; i < n; i++) { if (x[i] cmp r) { r = x[i]; } } \
+        return r; \
+    }
+
+LSIMD_PICK(min, double, <)
+LSIMD_PICK(max, double, >)
+LSIMD_PICK(min_num, long, <)
+LSIMD_PICK(max_num, long, >)
+
+/* Sum Numbers into "r", nonzero if the sum does not fit in a long */
+int lsimd_sum_num(long* x, int n, long* r) {
+    long s = 0;
+    long carry = 0;
+    for (int i = 0; i < n; i++) {
+        if (lnum_add(s, x[i], &s)) { carry += x[i] < 0 ? -1 : 1; }
+    }
+    *r = s;
+    return carry != 0;
+}
+
+#define LSIMD_MAP(name, opr) \
+    void lsimd_##name(double* r, double* x, int sx, double* y, int sy, int n) { \
+        if (sx && sy) { \
+            for (int i = 0; i < n; i++) { r[i] = x[i] opr y[i]; } \
+        } else if (sx) { \
+            double b = y[0]; \
+            for (int i = 0; i < n; i++) { r[i] = x[i] opr b; } \
+        } else { \
+            double a = x[0]; \
+            for (int i = 0; i < n; i++) { r[i] = a opr y[i]; } \
+        } \
+    }
+
+LSIMD_MAP(add, +)
+LSIMD_MAP(sub, -)
+LSIMD_MAP(mul, *)
+LSIMD_MAP(div, /)
+
+/* Elementwise checked operators, nonzero if any result overflowed */
+#define LSIMD_MAP_NUM(name, checked) \
+    int lsimd_##name(long* r, long* x, int sx, long* y, int sy, int n) { \
+        int o = 0; \
+        for (int i = 0; i < n; i++) { \
+            o |= checked(x[i * sx], y[i * sy], &r[i]); \
+        } \
+        return o; \
+    }
+
+LSIMD_MAP_NUM(add_num, lnum_add)
+LSIMD_MAP_NUM(sub_num, lnum_sub)
+LSIMD_MAP_NUM(mul_num, lnum_mul)
+LSIMD_MAP_NUM(div_num, lnum_div)
+
+/* Keep the tile in a local array the compiler can hold in registers, */
+/* adding each step in order so every element sums as the naive loop */
+void lsimd_tile_portable(double* c, int ldc, double* a, int lda,
+        double* b, int ldb, int kc) {
+    double t[LSIMD_TILE_ROWS][LSIMD_TILE_COLS];
+    for (int r = 0; r < LSIMD_TILE_ROWS; r++) {
+        for (int j = 0; j < LSIMD_TILE_COLS; j++) { t[r][j] = c[r * ldc + j]; }
+    }
+    for (int p = 0; p < kc; p++) {
+        for (int r = 0; r < LSIMD_TILE_ROWS; r++) {
+            double x = a[r * lda + p];
+            for (int j = 0; j < LSIMD_TILE_COLS; j++) {
+                t[r][j] += x * b[p * ldb + j];
+            }
+        }
+    }
+    for (int r = 0; r < LSIMD_TILE_ROWS; r++) {
+        for (int j = 0; j < LSIMD_TILE_COLS; j++) { c[r * ldc + j] = t[r][j]; }
+    }
+}
+
+/* The characters which give text its shape, all else can be skipped */
+static const char lsimd_shape[256] = {
+    ['('] = 1, [')'] = 1, ['{'] = 1, ['}'] = 1, ['"'] = 1, [';'] = 1,
+    ['\n'] = 1,
+};
+
+const char* lsimd_scan(const char* p, const char* end) {
+    while (p < end && !lsimd_shape[(unsigned char)*p]) { p++; }
+    return p;
+}
+
+lsimd lsimd_portable = {
+    lsimd_sum, lsimd_prod, lsimd_min, lsimd_max, lsimd_dot,
+    lsimd_sum_num, lsimd_min_num, lsimd_max_num,
+    { lsimd_add, lsimd_sub, lsimd_mul, lsimd_div },
+    { lsimd_add_num, lsimd_sub_num, lsimd_mul_num, lsimd_div_num },
+    lsimd_tile_portable,
+    lsimd_scan,
+};
+
+#ifdef LSIMD_AVX2
+
+#define LSIMD_TARGET __attribute__((target("avx2")))
+#define LSIMD_LOAD(p) _mm256_loadu_si256((__m256i*)(p))
+#define LSIMD_STORE(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+
+#define LSIMD_FOLD_AVX2(name, init, opr, vop) \
+    LSIMD_TARGET double lsimd_##name##_avx2(double* x, int n) { \
+        __m256d v = _mm256_set1_pd(init); \
+        int i = 0; \
+        for (; i + 4 <= n; i += 4) { v = vop(v, _mm256_loadu_pd(x + i)); } \
+        double r[4]; \
+        _mm256_storeu_pd(r, v); \
+        double t = (r[0] opr r[1]) opr (r[2] opr r[3]); \
+        for (; i < n; i++) { t = t opr x[i]; } \
+        return t; \
+    }
+
+LSIMD_FOLD_AVX2(sum, 0.0, +, _mm256_add_pd)
+LSIMD_FOLD_AVX2(prod, 1.0, *, _mm256_mul_pd)
+
+LSIMD_TARGET double lsimd_dot_avx2(double* x, double* y, int n) {
+    __m256d v = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        v = _mm256_add_pd(v, _mm256_mul_pd(_mm256_loadu_pd(x + i),
+                _mm256_loadu_pd(y + i)));
+    }
+    double r[4];
+    _mm256_storeu_pd(r, v);
+    double t = (r[0] + r[1]) + (r[2] + r[3]);
+    for (; i < n; i++) { t = t + x[i] * y[i]; }
+    return t;
+}
+
+/* Pick lanes of Numbers, AVX2 having no 64-bit min or max of its own */
+LSIMD_TARGET static inline __m256i lsimd_min_epi64(__m256i a, __m256i b) {
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+}
+LSIMD_TARGET static inline __m256i lsimd_max_epi64(__m256i a, __m256i b) {
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(b, a));
+}
+
+#define LSIMD_PICK_AVX2(name, type, cmp, vtype, load, store, vpick) \
+    LSIMD_TARGET type lsimd_##name##_avx2(type* x, int n) { \
+        if (n < 4) { return lsimd_##name(x, n); } \
+        vtype v = load(x); \
+        int i = 4; \
+        for (; i + 4 <= n; i += 4) { v = vpick(v, load(x + i)); } \
+        type r[4]; \
+        store(r, v); \
+        type t = r[0]; \
+        for (int k = 1; k < 4; k++) { if (r[k] cmp t) { t = r[k]; } } \
+        for (; i < n; i++) { if (x[i] cmp t) { t = x[i]; } } \
+        return t; \
+    }
+
+LSIMD_PICK_AVX2(min, double, <, __m256d,
+        _mm256_loadu_pd, _mm256_storeu_pd, _mm256_min_pd)
+LSIMD_PICK_AVX2(max, double, >, __m256d,
+        _mm256_loadu_pd, _mm256_storeu_pd, _mm256_max_pd)
+LSIMD_PICK_AVX2(min_num, long, <, __m256i,
+        LSIMD_LOAD, LSIMD_STORE, lsimd_min_epi64)
+LSIMD_PICK_AVX2(max_num, long, >, __m256i,
+        LSIMD_LOAD, LSIMD_STORE, lsimd_max_epi64)
+
+/* Lanes whose sign bit is set in "v", as all ones */
+#define LSIMD_NEG(v) _mm256_cmpgt_epi64(_mm256_setzero_si256(), v)
+
+LSIMD_TARGET int lsimd_sum_num_avx2(long* x, int n, long* r) {
+    __m256i s = _mm256_setzero_si256();
+    __m256i c = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i y = LSIMD_LOAD(x + i);
+        __m256i t = _mm256_add_epi64(s, y);
+        /* A lane overflowed if its sum differs in sign from both operands, */
+        /* carrying one up if "y" was positive and one down if negative */
+        __m256i o = LSIMD_NEG(_mm256_and_si256(_mm256_xor_si256(s, t),
+                _mm256_xor_si256(y, t)));
+        __m256i neg = LSIMD_NEG(y);
+        c = _mm256_sub_epi64(c, _mm256_andnot_si256(neg, o));
+        c = _mm256_add_epi64(c, _mm256_and_si256(neg, o));
+        s = t;
+    }
+    long ls[4], lc[4];
+    LSIMD_STORE(ls, s);
+    LSIMD_STORE(lc, c);
+    long sum = 0;
+    long carry = lc[0] + lc[1] + lc[2] + lc[3];
+    for (int k = 0; k < 4; k++) {
+        if (lnum_add(sum, ls[k], &sum)) { carry += ls[k] < 0 ? -1 : 1; }
+    }
+    for (; i < n; i++) {
+        if (lnum_add(sum, x[i], &sum)) { carry += x[i] < 0 ? -1 : 1; }
+    }
+    *r = sum;
+    return carry != 0;
+}
+
+#define LSIMD_MAP_AVX2(name, opr, vop) \
+    LSIMD_TARGET void lsimd_##name##_avx2(double* r, double* x, int sx, \
+            double* y, int sy, int n) { \
+        __m256d a = _mm256_set1_pd(x[0]); \
+        __m256d b = _mm256_set1_pd(y[0]); \
+        int i = 0; \
+        for (; i + 4 <= n; i += 4) { \
+            if (sx) { a = _mm256_loadu_pd(x + i); } \
+            if (sy) { b = _mm256_loadu_pd(y + i); } \
+            _mm256_storeu_pd(r + i, vop(a, b)); \
+        } \
+        for (; i < n; i++) { r[i] = x[i * sx] opr y[i * sy]; } \
+    }
+
+LSIMD_MAP_AVX2(add, +, _mm256_add_pd)
+LSIMD_MAP_AVX2(sub, -, _mm256_sub_pd)
+LSIMD_MAP_AVX2(mul, *, _mm256_mul_pd)
+LSIMD_MAP_AVX2(div, /, _mm256_div_pd)
+
+/* Elementwise + and - of Numbers, gathering the sign bits of lanes */
+/* that overflowed into "o". AVX2 has no 64-bit multiply or divide. */
+#define LSIMD_MAP_NUM_AVX2(name, checked, vop, ovf) \
+    LSIMD_TARGET int lsimd_##name##_avx2(long* r, long* x, int sx, \
+            long* y, int sy, int n) { \
+        __m256i a = _mm256_set1_epi64x(x[0]); \
+        __m256i b = _mm256_set1_epi64x(y[0]); \
+        __m256i o = _mm256_setzero_si256(); \
+        int i = 0; \
+        for (; i + 4 <= n; i += 4) { \
+            if (sx) { a = LSIMD_LOAD(x + i); } \
+            if (sy) { b = LSIMD_LOAD(y + i); } \
+            __m256i t = vop(a, b); \
+            o = _mm256_or_si256(o, ovf); \
+            LSIMD_STORE(r + i, t); \
+        } \
+        int f = _mm256_movemask_pd(_mm256_castsi256_pd(o)) != 0; \
+        for (; i < n; i++) { \
+            f |= checked(x[i * sx], y[i * sy], &r[i]); \
+        } \
+        return f; \
+    }
+
+LSIMD_MAP_NUM_AVX2(add_num, lnum_add, _mm256_add_epi64,
+        _mm256_and_si256(_mm256_xor_si256(a, t), _mm256_xor_si256(b, t)))
+LSIMD_MAP_NUM_AVX2(sub_num, lnum_sub, _mm256_sub_epi64,
+        _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(a, t)))
+
+/* The tile lives in eight registers, two for each of its four rows. */
+/* Multiplies and adds stay separate, as fused ones would round apart */
+/* from the portable kernel. */
+LSIMD_TARGET void lsimd_tile_avx2(double* c, int ldc, double* a, int lda,
+        double* b, int ldb, int kc) {
+    __m256d t[LSIMD_TILE_ROWS][2];
+    for (int r = 0; r < LSIMD_TILE_ROWS; r++) {
+        t[r][0] = _mm256_loadu_pd(c + r * ldc);
+        t[r][1] = _mm256_loadu_pd(c + r * ldc + 4);
+    }
+    for (int p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_loadu_pd(b + p * ldb);
+        __m256d b1 = _mm256_loadu_pd(b + p * ldb + 4);
+        for (int r = 0; r < LSIMD_TILE_ROWS; r++) {
+            __m256d x = _mm256_broadcast_sd(a + r * lda + p);
+            t[r][0] = _mm256_add_pd(t[r][0], _mm256_mul_pd(x, b0));
+            t[r][1] = _mm256_add_pd(t[r][1], _mm256_mul_pd(x, b1));
+        }
+    }
+    for (int r = 0; r < LSIMD_TILE_ROWS; r++) {
+        _mm256_storeu_pd(c + r * ldc, t[r][0]);
+        _mm256_storeu_pd(c + r * ldc + 4, t[r][1]);
+    }
+}
+
+/* Compare 32 bytes at once against each character of the shape */
+LSIMD_TARGET const char* lsimd_scan_avx2(const char* p, const char* end) {
+    static const char set[] = "(){}\";\n";
+    __m256i c[7];
+    for (int i = 0; i < 7; i++) { c[i] = _mm256_set1_epi8(set[i]); }
+    for (; end - p >= 32; p += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)p);
+        __m256i m = _mm256_cmpeq_epi8(x, c[0]);
+        for (int i = 1; i < 7; i++) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, c[i]));
+        }
+        unsigned bits = _mm256_movemask_epi8(m);
+        if (bits) { return p + __builtin_ctz(bits); }
+    }
+    return lsimd_scan(p, end);
+}
+
+lsimd lsimd_avx2 = {
+    lsimd_sum_avx2, lsimd_prod_avx2, lsimd_min_avx2, lsimd_max_avx2,
+    lsimd_dot_avx2, lsimd_sum_num_avx2, lsimd_min_num_avx2,
+    lsimd_max_num_avx2,
+    { lsimd_add_avx2, lsimd_sub_avx2, lsimd_mul_avx2, lsimd_div_avx2 },
+    { lsimd_add_num_avx2, lsimd_sub_num_avx2, lsimd_mul_num, lsimd_div_num },
+    lsimd_tile_avx2,
+    lsimd_scan_avx2,
+};
+
+#endif
+
+/* The kernels in use */
+lsimd* lsimd_ops = &lsimd_portable;
+
+/* Use the AVX2 kernels if the CPU has them */
+void lsimd_init(void) {
+#ifdef LSIMD_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) { lsimd_ops = &lsimd_avx2; }
+#endif
+}
+
+/* Vector Functions */
+
+/* Construct a Vector of "count" Numbers, or Doubles if "dbl" is set */
+lval* lval_vec_from(lval** cells, int count, int dbl) {
+    lval* v = lval_vec(count, dbl);
+    for (int i = 0; i < count; i++) {
+        if (dbl) {
+            LVDNUMS(v)[i] = LDNUM(cells[i]);
+        } else {
+            LVNUMS(v)[i] = LNUM(cells[i]);
+        }
+    }
+    return v;
+}
+
+/* Vector of its arguments, all Numbers or all Doubles */
+lval* builtin_vec(lenv* e, int argc, lval** argv) {
+    int t = argc && LTYPE(argv[0]) == LVAL_DNUM ? LVAL_DNUM : LVAL_NUM;
+    for (int i = 0; i < argc; i++) {
+        LASSERT_TYPE(vec, i, t);
+    }
+    
+    return lval_vec_from(argv, argc, t == LVAL_DNUM);
+}
+
+/* Vector of the elements of a list, all Numbers or all Doubles */
+lval* builtin_list_to_vec(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(list->vec, 1);
+    LASSERT_TYPE(list->vec, 0, LVAL_QEXPR);
+    
+    lval* l = argv[0];
+    int t = LCOUNT(l) && LTYPE(LCELL(l)[0]) == LVAL_DNUM ? LVAL_DNUM : LVAL_NUM;
+    for (int i = 0; i < LCOUNT(l); i++) {
+        LASSERT(LTYPE(LCELL(l)[i]) == t,
+                "Function 'list->vec' passed incorrect type for element %i. "
+                "Got %s, Expected %s.",
+                i, ltype_name(LTYPE(LCELL(l)[i])), ltype_name(t));
+    }
+    
+    return lval_vec_from(LCELL(l), LCOUNT(l), t == LVAL_DNUM);
+}
+
+/* List of the elements of a Vector */
+lval* builtin_vec_to_list(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(vec->list, 1);
+    LASSERT_TYPE(vec->list, 0, LVAL_VEC);
+    
+    lval* v = argv[0];
+    lvec* b = lvec_new(LVCOUNT(v), 0);
+    for (int i = 0; i < LVCOUNT(v); i++) {
+        b->cell[b->hi++] = LVDBL(v) ? lval_dnum(LVDNUMS(v)[i])
+            : lval_num(LVNUMS(v)[i]);
+    }
+    return lval_view(LVAL_QEXPR, b, b->cell, LVCOUNT(v));
+}
+
+/* Range from "start" up to but not including "end" by "step" */
+/* Takes "end", "start end" or "start end step", all of one type */
+lval* builtin_range(lenv* e, int argc, lval** argv) {
+    LASSERT(argc >= 1 && argc <= 3,
+            "Function 'range' passed incorrect number of arguments. "
+            "Got %i, Expected 1 to 3.",
+            argc);
+    int t = LTYPE(argv[0]);
+    LASSERT(t == LVAL_NUM || t == LVAL_DNUM,
+            "Function 'range' passed incorrect type for argument 0. "
+            "Got %s, Expected %s or %s.",
+            ltype_name(t), ltype_name(LVAL_NUM), ltype_name(LVAL_DNUM));
+    for (int i = 1; i < argc; i++) {
+        LASSERT_TYPE(range, i, t);
+    }
+    
+    if (t == LVAL_DNUM) {
+        double start = argc > 1 ? LDNUM(argv[0]) : 0.0;
+        double end = LDNUM(argv[argc > 1]);
+        double step = argc > 2 ? LDNUM(argv[2]) : 1.0;
+        LASSERT(step != 0.0, "Function 'range' passed a step of 0.");
+        double n = ceil((end - start) / step);
+        if (!(n > 0)) { n = 0; }
+        LASSERT(n <= INT_MAX,
+                "Function 'range' passed a range of %.0lf elements.", n);
+        
+        lval* v = lval_vec(n, 1);
+        for (int i = 0; i < LVCOUNT(v); i++) {
+            LVDNUMS(v)[i] = start + i * step;
+        }
+        return v;
+    }
+    
+    long start = argc > 1 ? LNUM(argv[0]) : 0;
+    long end = LNUM(argv[argc > 1]);
+    long step = argc > 2 ? LNUM(argv[2]) : 1;
+    LASSERT(step != 0, "Function 'range' passed a step of 0.");
+    
+    /* Count in unsigned arithmetic, where the distance always fits */
+    unsigned long span = 0;
+    if (step > 0 && end > start) { span = (unsigned long)end - start; }
+    if (step < 0 && start > end) { span = (unsigned long)start - end; }
+    unsigned long by = step > 0 ? (unsigned long)step : -(unsigned long)step;
+    unsigned long n = span ? (span - 1) / by + 1 : 0;
+    LASSERT(n <= INT_MAX,
+            "Function 'range' passed a range of %lu elements.", n);
+    
+    lval* v = lval_vec(n, 0);
+    for (int i = 0; i < LVCOUNT(v); i++) {
+        LVNUMS(v)[i] = (long)((unsigned long)start + i * (unsigned long)step);
+    }
+    return v;
+}
+
+/* Check the single Vector argument of a reduction */
+#define LASSERT_REDUCE(fun) \
+    LASSERT_ARGC(fun, 1); \
+    LASSERT_TYPE(fun, 0, LVAL_VEC)
+#define LASSERT_VNEMPTY(fun) \
+    LASSERT(LVCOUNT(argv[0]) != 0, \
+            "Function '" #fun "' passed []!")
+
+/* Sum */
+lval* builtin_vsum(lenv* e, int argc, lval** argv) {
+    LASSERT_REDUCE(vsum);
+    
+    lval* v = argv[0];
+    if (LVDBL(v)) { return lval_dnum(lsimd_ops->sum(LVDNUMS(v), LVCOUNT(v))); }
+    long r;
+    if (lsimd_ops->sum_num(LVNUMS(v), LVCOUNT(v), &r)) {
+        return lval_err("Integer overflow in 'vsum'.");
+    }
+    return lval_num(r);
+}
+
+/* Product */
+lval* builtin_vprod(lenv* e, int argc, lval** argv) {
+    LASSERT_REDUCE(vprod);
+    
+    lval* v = argv[0];
+    if (LVDBL(v)) { return lval_dnum(lsimd_ops->prod(LVDNUMS(v), LVCOUNT(v))); }
+    long r = 1;
+    for (int i = 0; i < LVCOUNT(v); i++) {
+        if (lnum_mul(r, LVNUMS(v)[i], &r)) {
+            return lval_err("Integer overflow in 'vprod'.");
+        }
+    }
+    return lval_num(r);
+}
+
+/* Minimum and Maximum */
+lval* builtin_vmin(lenv* e, int argc, lval** argv) {
+    LASSERT_REDUCE(vmin);
+    LASSERT_VNEMPTY(vmin);
+    
+    lval* v = argv[0];
+    if (LVDBL(v)) { return lval_dnum(lsimd_ops->min(LVDNUMS(v), LVCOUNT(v))); }
+    return lval_num(lsimd_ops->min_num(LVNUMS(v), LVCOUNT(v)));
+}
+
+lval* builtin_vmax(lenv* e, int argc, lval** argv) {
+    LASSERT_REDUCE(vmax);
+    LASSERT_VNEMPTY(vmax);
+    
+    lval* v = argv[0];
+    if (LVDBL(v)) { return lval_dnum(lsimd_ops->max(LVDNUMS(v), LVCOUNT(v))); }
+    return lval_num(lsimd_ops->max_num(LVNUMS(v), LVCOUNT(v)));
+}
+
+/* Check two Vectors have the same length and kind of element */
+#define LASSERT_VPAIR(fun, x, y) \
+    LASSERT(LVDBL(x) == LVDBL(y), \
+            "Function '%s' passed Vectors of unequal type. " \
+            "Got %s and %s, Expect them to be equal.", fun, \
+            ltype_name(LVDBL(x) ? LVAL_DNUM : LVAL_NUM), \
+            ltype_name(LVDBL(y) ? LVAL_DNUM : LVAL_NUM)); \
+    LASSERT(LVCOUNT(x) == LVCOUNT(y), \
+            "Function '%s' passed Vectors of unequal length. " \
+            "Got %i and %i.", fun, LVCOUNT(x), LVCOUNT(y))
+
+/* Dot product */
+lval* builtin_vdot(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(vdot, 2);
+    LASSERT_TYPE(vdot, 0, LVAL_VEC);
+    LASSERT_TYPE(vdot, 1, LVAL_VEC);
+    
+    lval* x = argv[0];
+    lval* y = argv[1];
+    LASSERT_VPAIR("vdot", x, y);
+    
+    if (LVDBL(x)) {
+        return lval_dnum(lsimd_ops->dot(LVDNUMS(x), LVDNUMS(y), LVCOUNT(x)));
+    }
+    long r = 0;
+    for (int i = 0; i < LVCOUNT(x); i++) {
+        long p;
+        if (lnum_mul(LVNUMS(x)[i], LVNUMS(y)[i], &p) || lnum_add(r, p, &r)) {
+            return lval_err("Integer overflow in 'vdot'.");
+        }
+    }
+    return lval_num(r);
+}
+
+/* Apply the "k"th elementwise operator to two Vectors, or to a Vector */
+/* and a Number or Double broadcast along it */
+lval* builtin_vop(lenv* e, int argc, lval** argv, char* op, int k) {
+    LASSERT(argc == 2,
+            "Function '%s' passed incorrect number of arguments. "
+            "Got %i, Expected %i.",
+            op, argc, 2);
+    
+    lval* x = argv[0];
+    lval* y = argv[1];
+    int sx = LTYPE(x) == LVAL_VEC;
+    int sy = LTYPE(y) == LVAL_VEC;
+    
+    /* The other argument of a single Vector must be a matching scalar */
+    for (int i = 0; i < 2; i++) {
+        int t = LTYPE(argv[i]);
+        LASSERT(t == LVAL_VEC || t == LVAL_NUM || t == LVAL_DNUM,
+                "Function '%s' passed incorrect type for argument %i. "
+                "Got %s, Expected %s, %s or %s.",
+                op, i, ltype_name(t), ltype_name(LVAL_VEC),
+                ltype_name(LVAL_NUM), ltype_name(LVAL_DNUM));
+    }
+    LASSERT(sx || sy, "Function '%s' passed no Vector.", op);
+    if (sx && sy) { LASSERT_VPAIR(op, x, y); }
+    int dbl = sx ? LVDBL(x) : LVDBL(y);
+    int t = dbl ? LVAL_DNUM : LVAL_NUM;
+    LASSERT(sx || LTYPE(x) == t,
+            "Function '%s' passed incorrect type for argument 0. "
+            "Got %s, Expected %s.",
+            op, ltype_name(LTYPE(x)), ltype_name(t));
+    LASSERT(sy || LTYPE(y) == t,
+            "Function '%s' passed incorrect type for argument 1. "
+            "Got %s, Expected %s.",
+            op, ltype_name(LTYPE(y)), ltype_name(t));
+    
+    int n = sx ? LVCOUNT(x) : LVCOUNT(y);
+    if (dbl) {
+        double a = sx ? 0.0 : LDNUM(x);
+        double b = sy ? 0.0 : LDNUM(y);
+        lval* r = lval_vec(n, 1);
+        lsimd_ops->map[k](LVDNUMS(r), sx ? LVDNUMS(x) : &a, sx,
+                sy ? LVDNUMS(y) : &b, sy, n);
+        return r;
+    }
+    
+    long a = sx ? 0 : LNUM(x);
+    long b = sy ? 0 : LNUM(y);
+    long* py = sy ? LVNUMS(y) : &b;
+    
+    /* Find any division by zero before dividing */
+    if (k == 3) {
+        for (int i = 0; i < (sy ? n : 1); i++) {
+            LASSERT(py[i] != 0, "Division By Zero!");
+        }
+    }
+    
+    lval* r = lval_vec(n, 0);
+    if (lsimd_ops->map_num[k](LVNUMS(r), sx ? LVNUMS(x) : &a, sx, py, sy, n)) {
+        lval_del(r);
+        return lval_err("Integer overflow in '%s'.", op);
+    }
+    return r;
+}
+
+/* Builtin elementwise operators */
+lval* builtin_vadd(lenv* e, int argc, lval** argv) {
+    return builtin_vop(e, argc, argv, "v+", 0);
+}
+
+lval* builtin_vsub(lenv* e, int argc, lval** argv) {
+    return builtin_vop(e, argc, argv, "v-", 1);
+}
+
+lval* builtin_vmul(lenv* e, int argc, lval** argv) {
+    return builtin_vop(e, argc, argv, "v*", 2);
+}
+
+lval* builtin_vdiv(lenv* e, int argc, lval** argv) {
+    return builtin_vop(e, argc, argv, "v/", 3);
+}
+
+/* Matrix Kernels */
+/* The product runs over blocks of LMAT_KC steps, LMAT_MC rows of "a" */
+/* and LMAT_NC columns of "b" sized to stay in cache while the tile */
+/* kernel sweeps them. Each element still adds its steps in order, so */
+/* the result is the same as the naive triple loop gives. */
+#define LMAT_KC 256
+#define LMAT_MC 64
+#define LMAT_NC 256
+/* Transposes move square blocks of this side */
+#define LMAT_TB 32
+
+static inline int lmat_min(int x, int y) { return x < y ? x : y; }
+
+/* Add a block of the product into the rows "i0" up to "i1" and columns */
+/* "j0" up to "j1" of "c" element by element, where no tile fits */
+void lmat_mul_rest(double* c, double* a, double* b, int k, int n,
+        int i0, int i1, int j0, int j1, int kk, int kc) {
+    for (int i = i0; i < i1; i++) {
+        for (int p = kk; p < kk + kc; p++) {
+            double x = a[(size_t)i * k + p];
+            for (int j = j0; j < j1; j++) {
+                c[(size_t)i * n + j] += x * b[(size_t)p * n + j];
+            }
+        }
+    }
+}
+
+/* Set "c" to the product of "a", "m" by "k", and "b", "k" by "n" */
+/* Each block of steps of "b" is first copied into panels as wide as a */
+/* tile, so the kernel reads it in order rather than a row of "b" apart */
+void lmat_mul(double* c, double* a, double* b, int m, int k, int n) {
+    memset(c, 0, (size_t)m * n * sizeof(double));
+    int nt = n - n % LSIMD_TILE_COLS;
+    double* panel = malloc(((size_t)lmat_min(LMAT_KC, k) * nt + 1) * sizeof(double));
+    for (int kk = 0; kk < k; kk += LMAT_KC) {
+        int kc = lmat_min(LMAT_KC, k - kk);
+        
+        /* Pack the steps "kk" up to "kk + kc" of the columns tiles cover */
+        double* q = panel;
+        for (int j = 0; j < nt; j += LSIMD_TILE_COLS) {
+            for (int p = kk; p < kk + kc; p++) {
+                memcpy(q, b + (size_t)p * n + j, LSIMD_TILE_COLS * sizeof(double));
+                q += LSIMD_TILE_COLS;
+            }
+        }
+        
+        for (int ii = 0; ii < m; ii += LMAT_MC) {
+            int i1 = lmat_min(ii + LMAT_MC, m);
+            int it = i1 - (i1 - ii) % LSIMD_TILE_ROWS;
+            for (int jj = 0; jj < nt; jj += LMAT_NC) {
+                int jt = lmat_min(jj + LMAT_NC, nt);
+                for (int i = ii; i < it; i += LSIMD_TILE_ROWS) {
+                    for (int j = jj; j < jt; j += LSIMD_TILE_COLS) {
+                        lsimd_ops->tile(c + (size_t)i * n + j, n,
+                                a + (size_t)i * k + kk, k,
+                                panel + (size_t)j * kc, LSIMD_TILE_COLS, kc);
+                    }
+                }
+            }
+            lmat_mul_rest(c, a, b, k, n, ii, it, nt, n, kk, kc);
+            lmat_mul_rest(c, a, b, k, n, it, i1, 0, n, kk, kc);
+        }
+    }
+    free(panel);
+}
+
+/* Set "t" to the transpose of "a", "m" by "n" */
+void lmat_transpose(double* t, double* a, int m, int n) {
+    for (int ii = 0; ii < m; ii += LMAT_TB) {
+        for (int jj = 0; jj < n; jj += LMAT_TB) {
+            int i1 = lmat_min(ii + LMAT_TB, m);
+            int j1 = lmat_min(jj + LMAT_TB, n);
+            for (int i = ii; i < i1; i++) {
+                for (int j = jj; j < j1; j++) {
+                    t[(size_t)j * m + i] = a[(size_t)i * n + j];
+                }
+            }
+        }
+    }
+}
+
+/* Matrix Functions */
+/* Matrices are shared by every name holding them, so mset changes */
+/* the Matrix in place for all of them */
+
+/* Check an argument is a Matrix */
+#define LASSERT_MAT(fun, i) LASSERT_TYPE(fun, i, LVAL_MAT)
+
+/* Check "i" and "j" are Numbers indexing an element of "m" */
+#define LASSERT_MINDEX(fun, m, i, j) \
+    LASSERT_TYPE(fun, i, LVAL_NUM); \
+    LASSERT_TYPE(fun, j, LVAL_NUM); \
+    LASSERT(LNUM(argv[i]) >= 0 && LNUM(argv[i]) < LMROWS(m) && \
+            LNUM(argv[j]) >= 0 && LNUM(argv[j]) < LMCOLS(m), \
+            "Function '" #fun "' passed index (%li, %li) of a %i by %i Matrix.", \
+            LNUM(argv[i]), LNUM(argv[j]), LMROWS(m), LMCOLS(m))
+
+/* Matrix of a list of rows, each a list of Doubles of the same length */
+lval* lval_mat_rows(lval* l) {
+    int rows = LCOUNT(l);
+    int cols = 0;
+    for (int i = 0; i < rows; i++) {
+        lval* row = LCELL(l)[i];
+        LASSERT(LTYPE(row) == LVAL_QEXPR,
+                "Function 'mat' passed incorrect type for row %i. "
+                "Got %s, Expected %s.",
+                i, ltype_name(LTYPE(row)), ltype_name(LVAL_QEXPR));
+        if (i == 0) { cols = LCOUNT(row); }
+        LASSERT(LCOUNT(row) == cols,
+                "Function 'mat' passed rows of unequal length. "
+                "Got %i and %i.", cols, LCOUNT(row));
+        for (int j = 0; j < cols; j++) {
+            LASSERT(LTYPE(LCELL(row)[j]) == LVAL_DNUM,
+                    "Function 'mat' passed incorrect type for element (%i, %i). "
+                    "Got %s, Expected %s.",
+                    i, j, ltype_name(LTYPE(LCELL(row)[j])), ltype_name(LVAL_DNUM));
+        }
+    }
+    
+    lval* m = lval_mat(rows, cols);
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            LMDATA(m)[(size_t)i * cols + j] = LDNUM(LCELL(LCELL(l)[i])[j]);
+        }
+    }
+    return m;
+}
+
+/* Matrix from a list of rows, or of a shape filled with zeros or with */
+/* the elements of a Vector of Doubles */
+lval* builtin_mat(lenv* e, int argc, lval** argv) {
+    if (argc == 1) {
+        LASSERT_TYPE(mat, 0, LVAL_QEXPR);
+        return lval_mat_rows(argv[0]);
+    }
+    LASSERT(argc == 2 || argc == 3,
+            "Function 'mat' passed incorrect number of arguments. "
+            "Got %i, Expected 1 to 3.",
+            argc);
+    LASSERT_TYPE(mat, 0, LVAL_NUM);
+    LASSERT_TYPE(mat, 1, LVAL_NUM);
+    long rows = LNUM(argv[0]);
+    long cols = LNUM(argv[1]);
+    LASSERT(rows >= 0 && cols >= 0 && rows <= INT_MAX && cols <= INT_MAX &&
+            (cols == 0 || rows <= INT_MAX / cols),
+            "Function 'mat' passed invalid shape %li by %li.", rows, cols);
+    
+    if (argc == 2) { return lval_mat(rows, cols); }
+    
+    LASSERT_TYPE(mat, 2, LVAL_VEC);
+    LASSERT(LVDBL(argv[2]),
+            "Function 'mat' passed a Vector of incorrect type. "
+            "Got %s, Expected %s.",
+            ltype_name(LVAL_NUM), ltype_name(LVAL_DNUM));
+    LASSERT(LVCOUNT(argv[2]) == rows * cols,
+            "Function 'mat' passed a Vector of %i elements for %li by %li.",
+            LVCOUNT(argv[2]), rows, cols);
+    lval* m = lval_mat(rows, cols);
+    memcpy(LMDATA(m), LVDNUMS(argv[2]), (size_t)rows * cols * sizeof(double));
+    return m;
+}
+
+/* Element at row "i" and column "j" */
+lval* builtin_mref(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(mref, 3);
+    LASSERT_MAT(mref, 0);
+    lval* m = argv[0];
+    LASSERT_MINDEX(mref, m, 1, 2);
+    
+    return lval_dnum(LMDATA(m)[(size_t)LNUM(argv[1]) * LMCOLS(m) + LNUM(argv[2])]);
+}
+
+/* Set the element at row "i" and column "j" in place */
+lval* builtin_mset(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(mset, 4);
+    LASSERT_MAT(mset, 0);
+    lval* m = argv[0];
+    LASSERT_MINDEX(mset, m, 1, 2);
+    LASSERT_TYPE(mset, 3, LVAL_DNUM);
+    
+    LMDATA(m)[(size_t)LNUM(argv[1]) * LMCOLS(m) + LNUM(argv[2])] = LDNUM(argv[3]);
+    return lval_sexpr();
+}
+
+/* Rows and columns */
+lval* builtin_mshape(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(mshape, 1);
+    LASSERT_MAT(mshape, 0);
+    
+    lval* v = lval_qexpr();
+    lval_add(v, lval_num(LMROWS(argv[0])));
+    lval_add(v, lval_num(LMCOLS(argv[0])));
+    return v;
+}
+
+/* Matrix product */
+lval* builtin_matmul(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(matmul, 2);
+    LASSERT_MAT(matmul, 0);
+    LASSERT_MAT(matmul, 1);
+    lval* a = argv[0];
+    lval* b = argv[1];
+    LASSERT(LMCOLS(a) == LMROWS(b),
+            "Function 'matmul' passed Matrices of unequal inner size. "
+            "Got %i by %i and %i by %i.",
+            LMROWS(a), LMCOLS(a), LMROWS(b), LMCOLS(b));
+    
+    lval* c = lval_mat(LMROWS(a), LMCOLS(b));
+    lmat_mul(LMDATA(c), LMDATA(a), LMDATA(b), LMROWS(a), LMCOLS(a), LMCOLS(b));
+    return c;
+}
+
+/* Transpose */
+lval* builtin_transpose(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(transpose, 1);
+    LASSERT_MAT(transpose, 0);
+    lval* a = argv[0];
+    
+    lval* t = lval_mat(LMCOLS(a), LMROWS(a));
+    lmat_transpose(LMDATA(t), LMDATA(a), LMROWS(a), LMCOLS(a));
+    return t;
+}
+
+/* Row "i" and column "j" as Vectors of Doubles */
+lval* builtin_mrow(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(mrow, 2);
+    LASSERT_MAT(mrow, 0);
+    LASSERT_TYPE(mrow, 1, LVAL_NUM);
+    lval* m = argv[0];
+    LASSERT(LNUM(argv[1]) >= 0 && LNUM(argv[1]) < LMROWS(m),
+            "Function 'mrow' passed row %li of a %i by %i Matrix.",
+            LNUM(argv[1]), LMROWS(m), LMCOLS(m));
+    
+    lval* v = lval_vec(LMCOLS(m), 1);
+    memcpy(LVDNUMS(v), LMDATA(m) + (size_t)LNUM(argv[1]) * LMCOLS(m),
+            LMCOLS(m) * sizeof(double));
+    return v;
+}
+
+lval* builtin_mcol(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(mcol, 2);
+    LASSERT_MAT(mcol, 0);
+    LASSERT_TYPE(mcol, 1, LVAL_NUM);
+    lval* m = argv[0];
+    LASSERT(LNUM(argv[1]) >= 0 && LNUM(argv[1]) < LMCOLS(m),
+            "Function 'mcol' passed column %li of a %i by %i Matrix.",
+            LNUM(argv[1]), LMROWS(m), LMCOLS(m));
+    
+    lval* v = lval_vec(LMROWS(m), 1);
+    for (int i = 0; i < LMROWS(m); i++) {
+        LVDNUMS(v)[i] = LMDATA(m)[(size_t)i * LMCOLS(m) + LNUM(argv[1])];
+    }
+    return v;
+}
+
+/* Sum of each row, and of each column, as Vectors of Doubles */
+lval* builtin_mrowsum(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(mrowsum, 1);
+    LASSERT_MAT(mrowsum, 0);
+    lval* m = argv[0];
+    
+    lval* v = lval_vec(LMROWS(m), 1);
+    for (int i = 0; i < LMROWS(m); i++) {
+        LVDNUMS(v)[i] = lsimd_ops->sum(LMDATA(m) + (size_t)i * LMCOLS(m), LMCOLS(m));
+    }
+    return v;
+}
+
+lval* builtin_mcolsum(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(mcolsum, 1);
+    LASSERT_MAT(mcolsum, 0);
+    lval* m = argv[0];
+    
+    /* Add the rows together one after another */
+    lval* v = lval_vec(LMCOLS(m), 1);
+    memset(LVDNUMS(v), 0, LMCOLS(m) * sizeof(double));
+    for (int i = 0; i < LMROWS(m); i++) {
+        lsimd_ops->map[0](LVDNUMS(v), LVDNUMS(v), 1,
+                LMDATA(m) + (size_t)i * LMCOLS(m), 1, LMCOLS(m));
+    }
+    return v;
+}
+
+/* Array Functions */
+/* An Array is shared by every name holding it, like a Matrix, so the */
+/* functions ending in ! change it in place for all of them. An Array */
+/* stored inside itself is never freed. */
+
+/* Check "i" is a Number indexing a slot of the Array "a" */
+#define LASSERT_AINDEX(fun, a, i) \
+    LASSERT_TYPE(fun, i, LVAL_NUM); \
+    LASSERT(LNUM(argv[i]) >= 0 && LNUM(argv[i]) < LACOUNT(a), \
+            "Function '" #fun "' passed index %li of an Array of %i.", \
+            LNUM(argv[i]), LACOUNT(a))
+
+/* Array of "n" slots, holding "x" or else () */
+lval* builtin_array(lenv* e, int argc, lval** argv) {
+    LASSERT(argc == 1 || argc == 2,
+            "Function 'array' passed incorrect number of arguments. "
+            "Got %i, Expected 1 or 2.",
+            argc);
+    LASSERT_TYPE(array, 0, LVAL_NUM);
+    LASSERT(LNUM(argv[0]) >= 0 && LNUM(argv[0]) <= INT_MAX / 2,
+            "Function 'array' passed invalid length %li.", LNUM(argv[0]));
+    
+    if (argc == 2) { return lval_array(LNUM(argv[0]), argv[1]); }
+    lval* x = lval_sexpr();
+    lval* a = lval_array(LNUM(argv[0]), x);
+    lval_del(x);
+    return a;
+}
+
+/* Value in slot "i" */
+lval* builtin_aget(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(aget, 2);
+    LASSERT_TYPE(aget, 0, LVAL_ARRAY);
+    lval* a = argv[0];
+    LASSERT_AINDEX(aget, a, 1);
+    
+    return lval_ref(LASLOT(a)[LNUM(argv[1])]);
+}
+
+/* Put "x" in slot "i" */
+lval* builtin_aset(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(aset!, 3);
+    LASSERT_TYPE(aset!, 0, LVAL_ARRAY);
+    lval* a = argv[0];
+    LASSERT_AINDEX(aset!, a, 1);
+    
+    lval** slot = &LASLOT(a)[LNUM(argv[1])];
+    lval* old = *slot;
+    *slot = lval_ref(argv[2]);
+    lval_del(old);
+    return lval_sexpr();
+}
+
+/* Number of slots */
+lval* builtin_alen(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(alen, 1);
+    LASSERT_TYPE(alen, 0, LVAL_ARRAY);
+    
+    return lval_num(LACOUNT(argv[0]));
+}
+
+/* Put "x" in every slot */
+lval* builtin_afill(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(afill!, 2);
+    LASSERT_TYPE(afill!, 0, LVAL_ARRAY);
+    lval* a = argv[0];
+    
+    for (int i = 0; i < LACOUNT(a); i++) {
+        lval* old = LASLOT(a)[i];
+        LASLOT(a)[i] = lval_ref(argv[1]);
+        lval_del(old);
+    }
+    return lval_sexpr();
+}
+
+/* New Array holding the same values */
+lval* builtin_acopy(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(acopy, 1);
+    LASSERT_TYPE(acopy, 0, LVAL_ARRAY);
+    lval* a = argv[0];
+    
+    lval* x = lval_sexpr();
+    lval* c = lval_array(LACOUNT(a), x);
+    lval_del(x);
+    for (int i = 0; i < LACOUNT(a); i++) {
+        lval_del(LASLOT(c)[i]);
+        LASLOT(c)[i] = lval_ref(LASLOT(a)[i]);
+    }
+    return c;
+}
+
+/* Add "x" in a new slot at the end, doubling the slots when full */
+lval* builtin_apush(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(apush!, 2);
+    LASSERT_TYPE(apush!, 0, LVAL_ARRAY);
+    lval* a = argv[0];
+    LASSERT(LACOUNT(a) < INT_MAX / 2,
+            "Function 'apush!' passed a full Array of %i.", LACOUNT(a));
+    
+    if (LACOUNT(a) == LACAP(a)) {
+        LASLOT(a) = (lval**)lpool_array_grow((void**)LASLOT(a), LACOUNT(a),
+                &LACAP(a));
+    }
+    LASLOT(a)[LACOUNT(a)++] = lval_ref(argv[1]);
+    return lval_sexpr();
+}
+
+/* Map Functions */
+/* Maps are persistent: map-assoc and map-dissoc give a new Map sharing */
+/* all but the changed path with the old one, which stays as it was. */
+
+/* Construct a Map "lval" from a root holding "count" keys */
+lval* lval_map(lhamt* root, int count) {
+    lval* v = lval_alloc();
+    v->type = LVAL_MAP;
+    v->rc = 1;
+    LHROOT(v) = root;
+    LHCOUNT(v) = count;
+    return v;
+}
+
+/* Map of a list of keys each followed by its value, taken as written */
+lval* builtin_map_new(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(map-new, 1);
+    LASSERT_TYPE(map-new, 0, LVAL_QEXPR);
+    lval* l = argv[0];
+    LASSERT(LCOUNT(l) % 2 == 0,
+            "Function 'map-new' passed a key without a value. "
+            "Got %i elements, Expected an even number.", LCOUNT(l));
+    
+    lval* m = lval_map(NULL, 0);
+    for (int i = 0; i < LCOUNT(l); i += 2) {
+        lval* k = LCELL(l)[i];
+        int added = 0;
+        unsigned long h;
+        lhamt_find(LHROOT(m), k, &h);
+        lhamt* n = lhamt_assoc(LHROOT(m), 0, h, k, LCELL(l)[i + 1], &added);
+        lhamt_del(LHROOT(m));
+        LHROOT(m) = n;
+        LHCOUNT(m) += added;
+    }
+    return m;
+}
+
+/* Value of a key, or of "default" if given and the key is missing */
+lval* builtin_map_get(lenv* e, int argc, lval** argv) {
+    LASSERT(argc == 2 || argc == 3,
+            "Function 'map-get' passed incorrect number of arguments. "
+            "Got %i, Expected 2 or 3.",
+            argc);
+    LASSERT_TYPE(map-get, 0, LVAL_MAP);
+    
+    unsigned long h;
+    lval* v = lhamt_find(LHROOT(argv[0]), argv[1], &h);
+    if (v) { return lval_ref(v); }
+    LASSERT(argc == 3, "Function 'map-get' passed a key not in the Map.");
+    return lval_ref(argv[2]);
+}
+
+/* Map with a key bound to a value */
+lval* builtin_map_assoc(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(map-assoc, 3);
+    LASSERT_TYPE(map-assoc, 0, LVAL_MAP);
+    
+    lval* m = argv[0];
+    int added = 0;
+    unsigned long h;
+    lhamt_find(LHROOT(m), argv[1], &h);
+    lhamt* n = lhamt_assoc(LHROOT(m), 0, h, argv[1], argv[2], &added);
+    return lval_map(n, LHCOUNT(m) + added);
+}
+
+/* Map without a key */
+lval* builtin_map_dissoc(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(map-dissoc, 2);
+    LASSERT_TYPE(map-dissoc, 0, LVAL_MAP);
+    
+    lval* m = argv[0];
+    int removed = 0;
+    unsigned long h;
+    lhamt_find(LHROOT(m), argv[1], &h);
+    lhamt* n = lhamt_dissoc(LHROOT(m), 0, h, argv[1], &removed);
+    return lval_map(n, LHCOUNT(m) - removed);
+}
+
+/* Append the keys under node "n" to the buffer "b" */
+void lhamt_keys(lhamt* n, lvec* b) {
+    for (int i = 0; n && i < n->count; i++) {
+        if (n->ent[i].sub) {
+            lhamt_keys(n->ent[i].sub, b);
+        } else {
+            b->cell[b->hi++] = lval_ref(n->ent[i].key);
+        }
+    }
+}
+
+/* List of the keys, in no particular order */
+lval* builtin_map_keys(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(map-keys, 1);
+    LASSERT_TYPE(map-keys, 0, LVAL_MAP);
+    
+    lvec* b = lvec_new(LHCOUNT(argv[0]), 0);
+    lhamt_keys(LHROOT(argv[0]), b);
+    return lval_view(LVAL_QEXPR, b, b->cell, LHCOUNT(argv[0]));
+}
+
+/* Number of keys */
+lval* builtin_map_count(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(map-count, 1);
+    LASSERT_TYPE(map-count, 0, LVAL_MAP);
+    
+    return lval_num(LHCOUNT(argv[0]));
+}
+
+/* Fold "f" over the keys and values under node "n", consuming "acc" */
+lval* lhamt_fold(lenv* e, lval* f, lval* acc, lhamt* n) {
+    for (int i = 0; n && i < n->count; i++) {
+        lhent* x = &n->ent[i];
+        if (x->sub) {
+            acc = lhamt_fold(e, f, acc, x->sub);
+        } else {
+            lval* args[3] = { acc, x->key, x->val };
+            lval* r = lval_call(e, f, 3, args);
+            lval_del(acc);
+            acc = r;
+        }
+        if (LTYPE(acc) == LVAL_ERR) { return acc; }
+    }
+    return acc;
+}
+
+/* Fold with "f" taking the value so far, a key and its value */
+lval* builtin_map_fold(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(map-fold, 3);
+    LASSERT_TYPE(map-fold, 0, LVAL_FUN);
+    LASSERT_TYPE(map-fold, 2, LVAL_MAP);
+    
+    /* The Map keeps its nodes alive however "f" is called */
+    lval* m = lval_ref(argv[2]);
+    lval* r = lhamt_fold(e, argv[0], lval_ref(argv[1]), LHROOT(m));
+    lval_del(m);
+    return r;
+}
+
+/* Memo Functions */
+
+/* Construct a cache of up to "cap" calls to "f" */
+lmemo* lmemo_new(lval* f, int cap) {
+    lmemo* m = malloc(sizeof(lmemo));
+    m->rc = 1;
+    m->f = lval_ref(f);
+    m->cap = cap;
+    m->count = 0;
+    m->nbuckets = 16;
+    m->buckets = calloc(m->nbuckets, sizeof(lmemo_ent*));
+    m->newest = m->oldest = NULL;
+    m->hits = m->misses = m->evictions = 0;
+    return m;
+}
+
+void lmemo_ent_del(lmemo_ent* x) {
+    for (int i = 0; i < x->argc; i++) { lval_del(x->argv[i]); }
+    lval_del(x->val);
+    free(x);
+}
+
+/* Delete a cache once no copy of its function holds it */
+void lmemo_del(lmemo* m) {
+    if (--m->rc > 0) { return; }
+    lmemo_ent* x = m->newest;
+    while (x) {
+        lmemo_ent* o = x->older;
+        lmemo_ent_del(x);
+        x = o;
+    }
+    free(m->buckets);
+    lval_del(m->f);
+    free(m);
+}
+
+/* Hash of a list of arguments */
+unsigned long lmemo_hash(int argc, lval** argv) {
+    unsigned long h = lhash_mix(argc + 1);
+    for (int i = 0; i < argc; i++) { h = lhash_add(h, lval_hash(argv[i])); }
+    return h;
+}
+
+/* Remembered call on equal arguments, or NULL */
+lmemo_ent* lmemo_find(lmemo* m, unsigned long h, int argc, lval** argv) {
+    lmemo_ent* x = m->buckets[h & (m->nbuckets - 1)];
+    for (; x; x = x->next) {
+        if (x->hash != h || x->argc != argc) { continue; }
+        int i = 0;
+        while (i < argc && lval_eq(x->argv[i], argv[i])) { i++; }
+        if (i == argc) { return x; }
+    }
+    return NULL;
+}
+
+/* Take an entry off the LRU list */
+void lmemo_unlink(lmemo* m, lmemo_ent* x) {
+    if (x->newer) { x->newer->older = x->older; } else { m->newest = x->older; }
+    if (x->older) { x->older->newer = x->newer; } else { m->oldest = x->newer; }
+}
+
+/* Put an entry at the front of the LRU list */
+void lmemo_push(lmemo* m, lmemo_ent* x) {
+    x->newer = NULL;
+    x->older = m->newest;
+    if (m->newest) { m->newest->newer = x; } else { m->oldest = x; }
+    m->newest = x;
+}
+
+/* Forget the least recently used call */
+void lmemo_evict(lmemo* m) {
+    lmemo_ent* x = m->oldest;
+    lmemo_ent** p = &m->buckets[x->hash & (m->nbuckets - 1)];
+    while (*p != x) { p = &(*p)->next; }
+    *p = x->next;
+    lmemo_unlink(m, x);
+    lmemo_ent_del(x);
+    m->count--;
+    m->evictions++;
+}
+
+/* Double the buckets once they hold more than one entry each on average */
+void lmemo_grow(lmemo* m) {
+    int n = m->nbuckets * 2;
+    lmemo_ent** b = calloc(n, sizeof(lmemo_ent*));
+    for (int i = 0; i < m->nbuckets; i++) {
+        lmemo_ent* x = m->buckets[i];
+        while (x) {
+            lmemo_ent* next = x->next;
+            x->next = b[x->hash & (n - 1)];
+            b[x->hash & (n - 1)] = x;
+            x = next;
+        }
+    }
+    free(m->buckets);
+    m->buckets = b;
+    m->nbuckets = n;
+}
+
+/* Remember that a call on "argv" gave "val" */
+void lmemo_insert(lmemo* m, unsigned long h, int argc, lval** argv,
+        lval* val) {
+    lmemo_ent* x = malloc(sizeof(lmemo_ent) + sizeof(lval*) * argc);
+    x->hash = h;
+    x->val = lval_ref(val);
+    x->argc = argc;
+    for (int i = 0; i < argc; i++) { x->argv[i] = lval_ref(argv[i]); }
+    
+    if (m->count >= m->nbuckets) { lmemo_grow(m); }
+    lmemo_ent** p = &m->buckets[h & (m->nbuckets - 1)];
+    x->next = *p;
+    *p = x;
+    lmemo_push(m, x);
+    m->count++;
+    
+    while (m->count > m->cap) { lmemo_evict(m); }
+}
+
+/* Call a memo function, running the one it wraps only on a miss */
+lval* lmemo_call(lenv* e, lval* f, int argc, lval** argv) {
+    lmemo* m = LMEMO(f);
+    unsigned long h = lmemo_hash(argc, argv);
+    
+    lmemo_ent* x = lmemo_find(m, h, argc, argv);
+    if (x) {
+        m->hits++;
+        lmemo_unlink(m, x);
+        lmemo_push(m, x);
+        return lval_ref(x->val);
+    }
+    m->misses++;
+    
+    /* The arguments may move once anything is called, so are held here */
+    lval** args = malloc(sizeof(lval*) * (argc + 1));
+    for (int i = 0; i < argc; i++) { args[i] = lval_ref(argv[i]); }
+    
+    /* The call may drop the last other hold on the cache */
+    m->rc++;
+    lval* r = lval_call(e, m->f, argc, args);
+    
+    /* Errors are not remembered, nor calls a recursive one already was */
+    if (LTYPE(r) != LVAL_ERR && !lmemo_find(m, h, argc, args)) {
+        lmemo_insert(m, h, argc, args, r);
+    }
+    lmemo_del(m);
+    for (int i = 0; i < argc; i++) { lval_del(args[i]); }
+    free(args);
+    return r;
+}
 
+/* Stands in for the function of a memo, which lmemo_call runs instead */
+lval* builtin_memoized(lenv* e, int argc, lval** argv) {
+    return lval_err("Memo function called without its cache.");
+}
 
-/* Builtin function head */
-lval* builtin_head(lenv* e, lval* a) {
-    LASSERT_FUN(head);
-    LASSERT_NEMPTY(head);
+/* Memo function remembering up to "capacity" calls of "f" */
+lval* builtin_memo(lenv* e, int argc, lval** argv) {
+    LASSERT(argc == 1 || argc == 2,
+            "Function 'memo' passed incorrect number of arguments. "
+            "Got %i, Expected 1 or 2.",
+            argc);
+    LASSERT_TYPE(memo, 0, LVAL_FUN);
+    
+    long cap = LMEMO_CAP;
+    if (argc == 2) {
+        LASSERT_TYPE(memo, 1, LVAL_NUM);
+        cap = LNUM(argv[1]);
+        LASSERT(cap > 0 && cap <= INT_MAX,
+                "Function 'memo' passed invalid capacity %li.", cap);
+    }
     
-    lval* v = lval_take(a, 0);
-    while (v->count > 1) { lval_del(lval_pop(v, 1)); }
+    lval* v = lval_fun(builtin_memoized);
+    LMEMO(v) = lmemo_new(argv[0], cap);
     return v;
 }
 
-/* Builtin function tail */
-lval* builtin_tail(lenv* e, lval* a) {
-    LASSERT_FUN(tail);
-    LASSERT_NEMPTY(tail);
+/* Hits, misses and evictions of a memo function so far */
+lval* builtin_memo_stats(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(memo-stats, 1);
+    LASSERT_TYPE(memo-stats, 0, LVAL_FUN);
+    LASSERT(LMEMO(argv[0]) && LBUILTIN(argv[0]),
+            "Function 'memo-stats' passed a Function not made by memo.");
     
-    lval* v = lval_take(a, 0);
-    lval_del(lval_pop(v, 0));
-    return v;
+    lmemo* m = LMEMO(argv[0]);
+    lvec* b = lvec_new(3, 0);
+    b->cell[b->hi++] = lval_num(m->hits);
+    b->cell[b->hi++] = lval_num(m->misses);
+    b->cell[b->hi++] = lval_num(m->evictions);
+    return lval_view(LVAL_QEXPR, b, b->cell, 3);
 }
 
-/* Builtin function list */
-lval* builtin_list(lenv* e, lval* a) {
-    a->type = LVAL_QEXPR;
-    return a;
+/* Timing */
+/* With --time, the seconds spent reading and evaluating files are */
+/* added up, reading counted on whichever thread did it */
+int ltime_on = 0;
+double ltime_read = 0;
+double ltime_eval = 0;
+
+/* Seconds from some fixed time, or 0 when not timing */
+double ltime_clock(void) {
+    if (!ltime_on) { return 0; }
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
 }
 
-/* Builtin function eval */
-lval* builtin_eval(lenv* e, lval* a) {
-    LASSERT_FUN(eval);
-    
-    lval* x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+/* Evaluate the forms of a list in order, deleting each once run */
+void lval_run(lenv* e, lval* forms) {
+    for (int i = 0; i < LCOUNT(forms); i++) {
+        double t = ltime_clock();
+        lval* x = lval_eval(e, LCELL(forms)[i]);
+        ltime_eval += ltime_clock() - t;
+        /* If Evaluation leads to error print it */
+        if (LTYPE(x) == LVAL_ERR) { lval_println(x); }
+        lval_del(x);
+        lval_del(LCELL(forms)[i]);
+    }
+    LCOUNT(forms) = 0;
 }
 
-/* Builtin function join */
-lval* builtin_join(lenv* e, lval* a) {
-    
-    for (int i = 0; i < a->count; i++) {
-        LASSERT(a, a->cell[i]->type == LVAL_QEXPR,
-                "Function 'join' passed incorrect type for argument %i. "
-                "Got %s, Expected %s",
-                i, ltype_name(a->cell[i]->type), LVAL_QEXPR);
+/* Form Cache */
+/* A ".lspy" file read without error leaves the forms read from it in */
+/* a cache file beside it, named with a "c" added, and later loads take */
+/* them from there. The cache names its format, the revision of the */
+/* reader, the interpreter and the length and hash of the text it was */
+/* read from, with a checksum of the forms, and if any of it does not */
+/* match the file is read again. A file that is not a cache is never */
+/* written over. */
+
+#define LISPY_VERSION "0.0.0.1.3"
+#define LCACHE_MAGIC "LSPYC"
+#define LCACHE_SOURCE ".lspy"
+
+/* Bump LCACHE_FORMAT whenever the layout of a cache or of the forms in */
+/* it changes, and LREAD_REVISION whenever the reader (lread_*, the */
+/* lval_read_* functions or the grammar) reads any text into other */
+/* forms, so that no cache written before is taken for the new one */
+#define LCACHE_FORMAT 2
+#define LREAD_REVISION 1
+
+/* Files longer than this are run as they are read, and not cached */
+#define LCACHE_MAX (4L << 20)
+
+/* Tags of forms in a cache */
+enum { LCACHE_NUM, LCACHE_DNUM, LCACHE_SYM, LCACHE_STR, LCACHE_ERR,
+       LCACHE_SEXPR, LCACHE_QEXPR };
+
+/* Whether loads use and write caches, unset by --no-cache */
+int lcache_on = 1;
+
+/* Bytes of a cache as it is written */
+typedef struct {
+    unsigned char* b;
+    long len;
+    long cap;
+} lbytes;
+
+/* Forms of a cache as they are written. Symbols are written once, in */
+/* a table before the forms, and in the forms as their place in it. */
+typedef struct {
+    lbytes forms;
+    lsym** syms;
+    int count;
+    int* slots;
+    int cap;
+} lcache_out;
+
+/* Bytes of a cache from "p" up to "end" as it is read, and the */
+/* symbols of its table */
+typedef struct {
+    const unsigned char* p;
+    const unsigned char* end;
+    lval** syms;
+    uint64_t count;
+} lcache_in;
+
+/* 64 bit FNV-1a hash of "n" bytes */
+uint64_t lcache_hash(const void* s, long n) {
+    const unsigned char* b = s;
+    uint64_t h = 14695981039346656037ULL;
+    for (long i = 0; i < n; i++) { h = (h ^ b[i]) * 1099511628211ULL; }
+    return h;
+}
+
+static void lbytes_put(lbytes* o, const void* s, long n) {
+    if (!n) { return; }
+    if (o->len + n > o->cap) {
+        while (o->len + n > o->cap) { o->cap = o->cap ? o->cap * 2 : 4096; }
+        o->b = realloc(o->b, o->cap);
     }
-    
-    lval* x = lval_pop(a, 0);
-    
-    while (a->count) {
-        x = lval_join(x, lval_pop(a, 0));
+    memcpy(o->b + o->len, s, n);
+    o->len += n;
+}
+
+static void lbytes_byte(lbytes* o, int c) {
+    unsigned char b = c;
+    lbytes_put(o, &b, 1);
+}
+
+/* Unsigned numbers take 7 bits a byte, the top bit set on all but */
+/* the last */
+static void lbytes_uint(lbytes* o, uint64_t x) {
+    while (x >= 0x80) {
+        lbytes_byte(o, (x & 0x7f) | 0x80);
+        x >>= 7;
     }
-    
-    lval_del(a);
-    return x;
+    lbytes_byte(o, x);
 }
 
-/* Eval operators on an Double "lval" */
-lval* builtin_op_double(lenv* e, lval* a, char* op) {
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
-    
-    /* If no arguments and sub then perform unary negation */
-    if (strcmp(op, "-") == 0 && a->count == 0) {
-        x->dnum = -x->dnum;
+static void lbytes_text(lbytes* o, const char* s) {
+    long n = strlen(s);
+    lbytes_uint(o, n);
+    lbytes_put(o, s, n);
+}
+
+/* Place of a symbol in the table of a cache, adding it if new */
+static int lcache_sym(lcache_out* o, lsym* y) {
+    /* Keep the slots at most half full */
+    if (o->count * 2 >= o->cap) {
+        free(o->slots);
+        o->cap = o->cap ? o->cap * 2 : 256;
+        o->slots = calloc(o->cap, sizeof(int));
+        o->syms = realloc(o->syms, sizeof(lsym*) * (o->cap / 2));
+        for (int k = 0; k < o->count; k++) {
+            int i = o->syms[k]->hash & (o->cap - 1);
+            while (o->slots[i]) { i = (i + 1) & (o->cap - 1); }
+            o->slots[i] = k + 1;
+        }
     }
     
-    /* While there are stillelements remaining */
-    while (a->count > 0) {
-        
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
-        
-        if (strcmp(op, "+") == 0) { x->dnum += y->dnum; }
-        if (strcmp(op, "-") == 0) { x->dnum -= y->dnum; }
-        if (strcmp(op, "*") == 0) { x->dnum *= y->dnum; }
-        if (strcmp(op, "/") == 0) { x->dnum /= y->dnum; }
-        
-        lval_del(y);
+    /* Slots hold places counted from 1, 0 being empty */
+    int i = y->hash & (o->cap - 1);
+    while (o->slots[i]) {
+        if (o->syms[o->slots[i] - 1] == y) { return o->slots[i] - 1; }
+        i = (i + 1) & (o->cap - 1);
     }
-    
-    lval_del(a); return x;
+    o->syms[o->count] = y;
+    o->slots[i] = ++o->count;
+    return o->count - 1;
 }
 
+void lcache_out_free(lcache_out* o) {
+    free(o->forms.b);
+    free(o->syms);
+    free(o->slots);
+}
 
-/* Eval operators on an "lval" */
-lval* builtin_op(lenv* e, lval* a, char* op) {
-    
-    int double_t = LVAL_NUM;
-    if (a->cell[0]->type == LVAL_DNUM) double_t = LVAL_DNUM;
-    
-    /* Ensure all arguments are numbers */
-    for (int i = 0; i < a->count; i++) {
-        if (a->cell[i]->type != double_t) {
-            lval* err = lval_err(
-                    "Function '%s' passed incorrect type for argument %i. "
-                    "Got %s, Expected %s.",
-                    op, i, ltype_name(a->cell[i]->type), ltype_name(double_t));
-            lval_del(a);
-            return err;
+/* Write a form as the reader made it, which is of no other type */
+void lcache_put(lcache_out* c, lval* v) {
+    lbytes* o = &c->forms;
+    switch (LTYPE(v)) {
+        case LVAL_NUM: {
+            /* Signs go in the low bit so small negatives stay short */
+            int64_t n = LNUM(v);
+            lbytes_byte(o, LCACHE_NUM);
+            lbytes_uint(o, ((uint64_t)n << 1) ^ (uint64_t)(n >> 63));
+            break;
         }
+        case LVAL_DNUM: {
+            double d = LDNUM(v);
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(d));
+            lbytes_byte(o, LCACHE_DNUM);
+            for (int i = 0; i < 8; i++) { lbytes_byte(o, bits >> (i * 8)); }
+            break;
+        }
+        case LVAL_SYM:
+            lbytes_byte(o, LCACHE_SYM);
+            lbytes_uint(o, lcache_sym(c, LSYMID(v)));
+            break;
+        case LVAL_STR: lbytes_byte(o, LCACHE_STR); lbytes_text(o, LSTR(v)); break;
+        case LVAL_ERR: lbytes_byte(o, LCACHE_ERR); lbytes_text(o, LERR(v)); break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            lbytes_byte(o, LTYPE(v) == LVAL_SEXPR ? LCACHE_SEXPR : LCACHE_QEXPR);
+            lbytes_uint(o, LCOUNT(v));
+            for (int i = 0; i < LCOUNT(v); i++) { lcache_put(c, LCELL(v)[i]); }
+            break;
     }
-    
-    /* If all Double, call builtin_op_double */
-    if (double_t == LVAL_DNUM) {
-        return builtin_op_double(e, a, op);
-    }
-    
-    /* Pop the first element */
-    lval* x = lval_pop(a, 0);
-    
-    /* If no arguments and sub then perform unary negation */
-    if (strcmp(op, "-") == 0 && a->count == 0) {
-        x->num = -x->num;
+}
+
+static int lcache_uint(lcache_in* in, uint64_t* x) {
+    *x = 0;
+    for (int s = 0; s < 64; s += 7) {
+        if (in->p == in->end) { return 0; }
+        int c = *in->p++;
+        *x |= (uint64_t)(c & 0x7f) << s;
+        if (!(c & 0x80)) { return 1; }
     }
-    
-    /* While there are stillelements remaining */
-    while (a->count > 0) {
+    return 0;
+}
+
+/* Read a form back, or NULL if the bytes are not one */
+lval* lcache_get(lcache_in* in) {
+    if (in->p == in->end) { return NULL; }
+    int tag = *in->p++;
+    uint64_t n;
+    switch (tag) {
+        case LCACHE_NUM:
+            if (!lcache_uint(in, &n)) { return NULL; }
+            return lval_num((long)((int64_t)(n >> 1) ^ -(int64_t)(n & 1)));
         
-        /* Pop the next element */
-        lval* y = lval_pop(a, 0);
+        case LCACHE_DNUM: {
+            if (in->end - in->p < 8) { return NULL; }
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; i++) { bits |= (uint64_t)*in->p++ << (i * 8); }
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return lval_dnum(d);
+        }
+        
+        case LCACHE_SYM:
+            if (!lcache_uint(in, &n) || n >= in->count) { return NULL; }
+            return in->syms[n];
         
-        if (strcmp(op, "+") == 0) { x->num += y->num; }
-        if (strcmp(op, "-") == 0) { x->num -= y->num; }
-        if (strcmp(op, "*") == 0) { x->num *= y->num; }
-        if (strcmp(op, "/") == 0) {
-            if (y->num == 0) {
-                lval_del(x); lval_del(y);
-                x = lval_err("Division By Zero!"); break;
+        case LCACHE_STR:
+        case LCACHE_ERR: {
+            if (!lcache_uint(in, &n) || n > (uint64_t)(in->end - in->p)) {
+                return NULL;
             }
-            x->num /= y->num;
+            const char* s = (const char*)in->p;
+            in->p += n;
+            char* t = malloc(n + 1);
+            memcpy(t, s, n);
+            t[n] = '\0';
+            lval* x = tag == LCACHE_STR ? lval_str(t) : lval_err("%s", t);
+            free(t);
+            return x;
         }
         
-        lval_del(y);
+        case LCACHE_SEXPR:
+        case LCACHE_QEXPR: {
+            /* Each form takes a byte at least */
+            if (!lcache_uint(in, &n) || n > (uint64_t)(in->end - in->p)) {
+                return NULL;
+            }
+            lval* x = tag == LCACHE_SEXPR ? lval_sexpr() : lval_qexpr();
+            for (uint64_t i = 0; i < n; i++) {
+                lval* y = lcache_get(in);
+                if (!y) {
+                    lval_del(x);
+                    return NULL;
+                }
+                lval_add(x, y);
+            }
+            return x;
+        }
     }
-    
-    lval_del(a); return x;
+    return NULL;
 }
 
-/* Builtin operator functions */
-lval* builtin_add(lenv* e, lval* a) {
-    return builtin_op(e, a, "+");
+/* Whether the file "name" is Lispy source, the only kind cached, so */
+/* that the name of a cache is never one another kind of file has */
+static int lcache_named(const char* name) {
+    size_t n = strlen(name);
+    size_t x = strlen(LCACHE_SOURCE);
+    return n > x && strcmp(name + n - x, LCACHE_SOURCE) == 0;
 }
 
-lval* builtin_sub(lenv* e, lval* a) {
-    return builtin_op(e, a, "-");
+/* Whether there is nothing at "path", or a cache that may be replaced */
+static int lcache_free(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) { return errno == ENOENT; }
+    char b[sizeof(LCACHE_MAGIC)];
+    size_t m = strlen(LCACHE_MAGIC);
+    int ours = fread(b, 1, m, f) == m && memcmp(b, LCACHE_MAGIC, m) == 0;
+    fclose(f);
+    return ours;
 }
 
-lval* builtin_mul(lenv* e, lval* a) {
-    return builtin_op(e, a, "*");
+/* Name of the cache of a file */
+static char* lcache_path(const char* name) {
+    char* path = malloc(strlen(name) + 2);
+    strcpy(path, name);
+    strcat(path, "c");
+    return path;
 }
 
-lval* builtin_div(lenv* e, lval* a) {
-    return builtin_op(e, a, "/");
+/* Write the "count" forms in "c", read from "len" bytes hashing to */
+/* "h", to the cache of the file "name", if it can be written */
+void lcache_save(const char* name, long len, uint64_t h, lcache_out* c,
+        long count) {
+    if (!lcache_named(name)) { return; }
+    
+    lbytes body = { NULL, 0, 0 };
+    lbytes_uint(&body, c->count);
+    for (int i = 0; i < c->count; i++) { lbytes_text(&body, c->syms[i]->name); }
+    lbytes_put(&body, c->forms.b, c->forms.len);
+    
+    lbytes head = { NULL, 0, 0 };
+    lbytes_put(&head, LCACHE_MAGIC, strlen(LCACHE_MAGIC));
+    lbytes_byte(&head, LCACHE_FORMAT);
+    lbytes_byte(&head, sizeof(long));
+    lbytes_uint(&head, LREAD_REVISION);
+    lbytes_text(&head, LISPY_VERSION);
+    lbytes_uint(&head, len);
+    lbytes_uint(&head, h);
+    lbytes_uint(&head, count);
+    lbytes_uint(&head, body.len);
+    lbytes_uint(&head, lcache_hash(body.b, body.len));
+    
+    /* Written under another name first, so no one reads half of it, */
+    /* and never in place of a file that is not a cache */
+    char* path = lcache_path(name);
+    char* tmp = malloc(strlen(path) + 32);
+    sprintf(tmp, "%s.%ld", path, (long)getpid());
+    FILE* f = lcache_free(path) ? fopen(tmp, "wbx") : NULL;
+    if (f) {
+        int ok = fwrite(head.b, 1, head.len, f) == (size_t)head.len &&
+            fwrite(body.b, 1, body.len, f) == (size_t)body.len;
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(tmp, path) != 0) { remove(tmp); }
+    }
+    free(tmp);
+    free(path);
+    free(head.b);
+    free(body.b);
 }
 
-/* Define a variable */
-lval* builtin_var(lenv* e, lval* a, char* func) {
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-            "Function '%s' passed incorrect type for argument 0. "
-            "Got %s, Expected %s.", func,
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+/* Whether the start of a cache matches "len" bytes hashing to "h", */
+/* giving the count of forms after it */
+static int lcache_head(lcache_in* in, long len, uint64_t h, uint64_t* count) {
+    long m = strlen(LCACHE_MAGIC);
+    long v = strlen(LISPY_VERSION);
+    if (in->end - in->p < m + 2 || memcmp(in->p, LCACHE_MAGIC, m) != 0 ||
+            in->p[m] != LCACHE_FORMAT || in->p[m + 1] != sizeof(long)) {
+        return 0;
+    }
+    in->p += m + 2;
     
-    /* First argument is symbol list */
-    lval* syms = a->cell[0];
+    uint64_t n;
+    if (!lcache_uint(in, &n) || n != LREAD_REVISION) { return 0; }
+    if (!lcache_uint(in, &n) || n != (uint64_t)v || in->end - in->p < v ||
+            memcmp(in->p, LISPY_VERSION, v) != 0) {
+        return 0;
+    }
+    in->p += v;
     
-    /* Ensure all elements of first list are symbols */
-    for (int i = 0; i < syms->count; i++) {
-        LASSERT(a, syms->cell[i]->type == LVAL_SYM,
-                "Function '%s' passed incorrect type for the %ith element in argument 1. "
-                "Got %s, Expected %s", func,
-                i, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+    uint64_t slen, hash, flen, sum;
+    return lcache_uint(in, &slen) && slen == (uint64_t)len &&
+        lcache_uint(in, &hash) && hash == h &&
+        lcache_uint(in, count) && lcache_uint(in, &flen) &&
+        lcache_uint(in, &sum) && flen == (uint64_t)(in->end - in->p) &&
+        sum == lcache_hash(in->p, flen);
+}
+
+/* The forms cached for the file "name" if they were read from "len" */
+/* bytes hashing to "h", or NULL */
+lval* lcache_load(const char* name, long len, uint64_t h) {
+    if (!lcache_named(name)) { return NULL; }
+    char* path = lcache_path(name);
+    FILE* f = fopen(path, "rb");
+    free(path);
+    if (!f) { return NULL; }
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode)) {
+        fclose(f);
+        return NULL;
     }
+    unsigned char* b = malloc(st.st_size + 1);
+    long n = fread(b, 1, st.st_size, f);
+    fclose(f);
     
-    /* Check correct number of symbols and values */
-    LASSERT(a, syms->count == a->count - 1,
-            "Function '%s' cannot varine incorrect number of values to symbols. "
-            "Got %i and %i, Expected them to be equal.", func,
-            syms->count, a->count - 1);
+    /* Everything before the forms must match, then come the forms and */
+    /* nothing after them */
+    lcache_in in = { b, b + n, NULL, 0 };
+    uint64_t count;
+    lval* x = lcache_head(&in, len, h, &count) ? lval_sexpr() : NULL;
     
-    /* Assign copies of values to symbols */
-    for (int i = 0; i < syms->count; i++) {
-        /* If 'def' define in globally. */
-        if (strcmp(func, "def") == 0) {
-            lenv_def(e, syms->cell[i], a->cell[i + 1]);
+    /* The symbols, each taking a byte at least */
+    if (x && (!lcache_uint(&in, &in.count) ||
+            in.count > (uint64_t)(in.end - in.p))) {
+        lval_del(x);
+        x = NULL;
+    }
+    if (x) { in.syms = malloc(sizeof(lval*) * in.count + 1); }
+    for (uint64_t i = 0; x && i < in.count; i++) {
+        uint64_t k;
+        if (!lcache_uint(&in, &k) || k > (uint64_t)(in.end - in.p)) {
+            lval_del(x);
+            x = NULL;
+            break;
         }
-        
-        /* If 'put' define in locally */
-        if (strcmp(func, "=") == 0) {
-            lenv_put(e, syms->cell[i], a->cell[i + 1]);
+        in.syms[i] = (lval*)((uintptr_t)lsym_intern_n((const char*)in.p, k) |
+                LVAL_IMM_SYM);
+        in.p += k;
+    }
+
+    for (uint64_t i = 0; x && i < count; i++) {
+        lval* y = lcache_get(&in);
+        if (!y) {
+            lval_del(x);
+            x = NULL;
+            break;
         }
+        lval_add(x, y);
     }
-    
-    lval_del(a);
-    return lval_sexpr();
+    if (x && in.p != in.end) {
+        lval_del(x);
+        x = NULL;
+    }
+    free(in.syms);
+    free(b);
+    return x;
 }
 
-lval* builtin_def(lenv* e, lval* a) {
-    return builtin_var(e, a, "def");
-}
+/* Parallel Reader */
+/* A file too big to be read at once is cut into chunks where a line */
+/* ends at the top level, so each chunk holds whole expressions and can */
+/* be read on its own, on a pool of threads. The file is taken a window */
+/* of chunks at a time: while one window is read the forms of the last */
+/* are evaluated, still in the order they were written. */
+#if defined(LTHREADS) && !defined(LISPY_MPC_READER)
+#define LPAR
 
-lval* builtin_put(lenv* e, lval* a) {
-    return builtin_var(e, a, "=");
-}
+/* Bytes at least in a chunk, and chunks a window has for each thread */
+#ifndef LPAR_CHUNK
+#define LPAR_CHUNK (1 << 18)
+#endif
+#define LPAR_WINDOW 4
+#define LPAR_MAX 8
 
-/* Define a lambda */
-lval* builtin_lambda(lenv* e, lval* a) {
-    /* Check Two arguments, each of which are Q-Expressions */
-    LASSERT(a, a->count == 2,
-            "Function \\ passed incorrect number of arguments. "
-            "Got %i, Expected 2.",
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-            "Function \\ passed incorrect type for argument 0. "
-            "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
-    LASSERT(a, a->cell[1]->type == LVAL_QEXPR,
-            "Function \\ passed incorrect type for argument 1. "
-            "Got %s, Expected %s.",
-            ltype_name(a->cell[1]->type), ltype_name(LVAL_QEXPR));
+/* Part of a file, "base" bytes and "row" lines into it, and the forms */
+/* read from it or those before an error. "done" is set once read. */
+typedef struct lchunk {
+    const char* name;
+    const char* s;
+    long len;
+    long base;
+    int row;
+    lval* forms;
+    char* err;
+    double secs;
+    int done;
+    struct lchunk* next;
+    struct lchunk* queue;
+} lchunk;
+
+/* Threads to read with, 1 reading files as they are evaluated */
+int lpar_threads = 1;
+
+static int lpar_started = 0;
+static pthread_mutex_t lpar_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lpar_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t lpar_done = PTHREAD_COND_INITIALIZER;
+static lchunk* lpar_head = NULL;
+static lchunk* lpar_tail = NULL;
+
+/* Read the forms of a chunk */
+void lchunk_read(lchunk* c) {
+    double t = ltime_clock();
+    lreader r;
+    lread_init(&r, c->name, c->s, c->len);
+    r.row = c->row;
+    r.base = c->base;
+    r.line = c->base;
     
-    /* Check first Q-Expression contains only Symbols */
-    for (int i = 0; i < a->cell[0]->count; i++) {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
-                "Function \\ passed incorrect type for the %ith element of argument 0. "
-                "Got %s, Expected %s.",
-                ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+    c->forms = lval_sexpr();
+    lval* x;
+    while ((x = lread_next(&r))) { lval_add(c->forms, x); }
+    c->err = r.err;
+    r.err = NULL;
+    lread_close(&r);
+    c->secs = ltime_clock() - t;
+}
+
+/* Read chunks as they are queued, for as long as the program runs */
+static void* lpar_worker(void* arg) {
+    pthread_mutex_lock(&lpar_lock);
+    while (1) {
+        while (!lpar_head) { pthread_cond_wait(&lpar_work, &lpar_lock); }
+        lchunk* c = lpar_head;
+        lpar_head = c->queue;
+        if (!lpar_head) { lpar_tail = NULL; }
+        pthread_mutex_unlock(&lpar_lock);
+        
+        lchunk_read(c);
+        
+        pthread_mutex_lock(&lpar_lock);
+        c->done = 1;
+        pthread_cond_broadcast(&lpar_done);
     }
-    
-    /* Pop first two arguments and pass them to lval_lambda */
-    lval* formals = lval_pop(a, 0);
-    lval* body = lval_pop(a, 0);
-    lval_del(a);
-    
-    return lval_lambda(formals, body);
+    return NULL;
 }
 
-/* Compare two Double "lval"s */
-lval* builtin_ord_double(lenv* e, lval* a, char* op) {
-    double r;
-    if (strcmp(op, ">") == 0) {
-        r = (a->cell[0]->dnum > a->cell[1]->dnum);
+/* Queue chunks to be read, starting the threads the first time */
+void lpar_submit(lchunk* c) {
+    if (!lpar_started) {
+        for (int i = 0; i < lpar_threads; i++) {
+            pthread_t t;
+            if (pthread_create(&t, NULL, lpar_worker, NULL) == 0) {
+                pthread_detach(t);
+                lpar_started++;
+            }
+        }
+        /* Without threads to read them, chunks are read here */
+        if (!lpar_started) { lpar_threads = 1; }
     }
-    if (strcmp(op, "<") == 0) {
-        r = (a->cell[0]->dnum < a->cell[1]->dnum);
+    if (!lpar_started) {
+        for (; c; c = c->next) {
+            lchunk_read(c);
+            c->done = 1;
+        }
+        return;
     }
-    if (strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->dnum > a->cell[1]->dnum ||
-                comp_eq(a->cell[0]->dnum, a->cell[1]->dnum));
+    
+    pthread_mutex_lock(&lpar_lock);
+    for (; c; c = c->next) {
+        c->queue = NULL;
+        if (lpar_tail) { lpar_tail->queue = c; } else { lpar_head = c; }
+        lpar_tail = c;
     }
-    if (strcmp(op, "<=") == 0) {
-        r = (a->cell[0]->dnum <= a->cell[1]->dnum ||
-                comp_eq(a->cell[0]->dnum, a->cell[1]->dnum));
+    pthread_cond_broadcast(&lpar_work);
+    pthread_mutex_unlock(&lpar_lock);
+}
+
+/* Wait for a chunk to be read */
+void lpar_wait(lchunk* c) {
+    pthread_mutex_lock(&lpar_lock);
+    while (!c->done) { pthread_cond_wait(&lpar_done, &lpar_lock); }
+    pthread_mutex_unlock(&lpar_lock);
+}
+
+/* Free chunks once they have been read */
+void lpar_free(lchunk* c) {
+    while (c) {
+        lchunk* next = c->next;
+        lpar_wait(c);
+        ltime_read += c->secs;
+        lval_del(c->forms);
+        free(c->err);
+        free(c);
+        c = next;
     }
-    lval_del(a);
-    return lval_dnum(r);
 }
 
-/* Compare two "lval"s */
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-    /* Check Two arguments, each of which are Numbers */
-    LASSERT(a, a->count == 2,
-            "Function %s passed incorrect number of arguments. "
-            "Got %i, Expected 2.", op, 
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_NUM || a->cell[0]->type == LVAL_DNUM,
-            "Function %s passed incorrect type for argument 0. "
-            "Got %s, Expected %s or %s.", op, 
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_NUM), ltype_name(LVAL_DNUM));
-    LASSERT(a, a->cell[1]->type == LVAL_NUM || a->cell[1]->type == LVAL_DNUM,
-            "Function %s passed incorrect type for argument 1. "
-            "Got %s, Expected %s or %s.", op, 
-            ltype_name(a->cell[1]->type), ltype_name(LVAL_NUM), ltype_name(LVAL_DNUM));
-    LASSERT(a, a->cell[0]->type == a->cell[1]->type,
-            "Function %s passed unequal type for argument 0 and 1. "
-            "Got %s and %s, Expect them to be equal.", op,
-            ltype_name(a->cell[0]->type), ltype_name(a->cell[1]->type));
+/* Add a chunk of the "len" bytes at "s" to the list ending at "*last" */
+static lchunk** lpar_chunk(lchunk** last, const char* name,
+        const char* s, long len, long base, int row) {
+    lchunk* c = malloc(sizeof(lchunk));
+    c->name = name;
+    c->s = s;
+    c->len = len;
+    c->base = base;
+    c->row = row;
+    c->forms = NULL;
+    c->err = NULL;
+    c->done = 0;
+    c->next = NULL;
+    *last = c;
+    return &c->next;
+}
+
+/* Cut the "len" bytes at "s", "base" bytes and "*row" lines into the */
+/* file, into chunks in order. What is left after the last cut, which */
+/* starts "*rest" bytes and "*row" lines in, is kept for the next */
+/* window, unless the file ends with it at "eof". */
+lchunk* lpar_cut(const char* name, const char* s, long len, long base,
+        int eof, long* rest, int* row) {
+    lchunk* first = NULL;
+    lchunk** last = &first;
+    const char* end = s + len;
+    const char* from = s;
+    int from_row = *row;
+    int rows = *row;
+    int depth = 0;
     
-    if (a->cell[0]->type == LVAL_DNUM) {
-        return builtin_ord_double(e, a, op);
+    /* Only brackets, quotes, comments and newlines matter to where */
+    /* expressions end, the rest is skipped a block at a time */
+    const char* p = s;
+    while ((p = lsimd_ops->scan(p, end)) < end) {
+        char c = *p++;
+        if (c == '\n') {
+            rows++;
+            if (!depth && p - from >= LPAR_CHUNK) {
+                last = lpar_chunk(last, name, from, p - from,
+                        base + (from - s), from_row);
+                from = p;
+                from_row = rows;
+            }
+        } else if (c == '(' || c == '{') {
+            depth++;
+        } else if (c == ')' || c == '}') {
+            /* One too many is an error reading will find */
+            if (depth) { depth--; }
+        } else if (c == '"') {
+            /* Strings are stepped over as the reader steps over them */
+            while (p < end && *p != '"' && *p) {
+                if (*p == '\\' && p + 1 < end) { p++; }
+                if (*p == '\n') { rows++; }
+                p++;
+            }
+            if (p < end) { p++; }
+        } else {
+            /* A comment ends where a line does */
+            while (p < end && *p != '\n' && *p != '\r' && *p) { p++; }
+        }
     }
     
-    int r;
-    if (strcmp(op, ">") == 0) {
-        r = (a->cell[0]->num > a->cell[1]->num);
+    if (eof && from < end) {
+        lpar_chunk(last, name, from, end - from, base + (from - s), from_row);
+        from = end;
     }
-    if (strcmp(op, "<") == 0) {
-        r = (a->cell[0]->num < a->cell[1]->num);
+    *rest = from - s;
+    *row = from_row;
+    return first;
+}
+
+/* Evaluate the forms of chunks in order, giving an error if reading */
+/* one of them failed, or NULL */
+lval* lpar_eval(lenv* e, lchunk* c) {
+    for (; c; c = c->next) {
+        lpar_wait(c);
+        lval_run(e, c->forms);
+        
+        /* What the reading threads made has been freed here */
+        lpool_give();
+        
+        if (c->err) { return lval_err("Could not load Library: %s", c->err); }
     }
-    if (strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->num >= a->cell[1]->num);
+    return NULL;
+}
+
+/* Evaluate each Expression of a file, reading ahead on other threads */
+lval* lpar_load(lenv* e, const char* name, FILE* f) {
+    long cap = (long)LPAR_CHUNK * LPAR_WINDOW * lpar_threads;
+    char* buf = NULL;
+    lchunk* chunks = NULL;
+    long rest = 0;
+    long keep = 0;
+    long base = 0;
+    int row = 0;
+    int eof = 0;
+    lval* x = NULL;
+    
+    while (1) {
+        /* Read the next window, after what was left of the last */
+        char* next = NULL;
+        lchunk* read = NULL;
+        if (!eof) {
+            if (keep * 2 > cap) { cap *= 2; }
+            next = malloc(cap);
+            if (keep) { memcpy(next, buf + rest, keep); }
+            long n = fread(next + keep, 1, cap - keep, f);
+            eof = n < cap - keep;
+            long len = keep + n;
+            read = lpar_cut(name, next, len, base, eof, &rest, &row);
+            base += rest;
+            keep = len - rest;
+            
+            /* A file read at once needs no threads */
+            if (!buf && eof && read && !read->next) {
+                lchunk_read(read);
+                read->done = 1;
+            } else {
+                lpar_submit(read);
+            }
+        }
+        
+        /* Evaluate the last window while this one is read */
+        if (buf) {
+            x = lpar_eval(e, chunks);
+            lpar_free(chunks);
+            free(buf);
+        }
+        buf = next;
+        chunks = read;
+        if (x || !buf) { break; }
     }
-    if (strcmp(op, "<=") == 0) {
-        r = (a->cell[0]->num <= a->cell[1]->num);
+    
+    /* Reading stops at an error, after what came before has been run */
+    lpar_free(chunks);
+    free(buf);
+    return x ? x : lval_sexpr();
+}
+
+/* Bytes of files given to run that may be read ahead of their turn */
+#define LPAR_AHEAD (64L << 20)
+
+/* A file given to run, and the chunks it was cut into */
+typedef struct {
+    char* buf;
+    long len;
+    uint64_t hash;
+    lchunk* chunks;
+    lval* forms;
+} lahead;
+
+/* Start reading the "n" files given to run, while the first of them */
+/* run. Only whole regular files are read, within LPAR_AHEAD bytes in */
+/* all, others are read in their turn. */
+lahead* lpar_ahead(char** names, int n) {
+    lahead* a = calloc(n, sizeof(lahead));
+    if (lpar_threads < 2) { return a; }
+    
+    long left = LPAR_AHEAD;
+    for (int i = 0; i < n; i++) {
+        if (strcmp(names[i], "-") == 0) { continue; }
+        FILE* f = fopen(names[i], "rb");
+        if (!f) { continue; }
+        struct stat st;
+        if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) ||
+                st.st_size > left) {
+            fclose(f);
+            continue;
+        }
+        
+        a[i].buf = malloc(st.st_size + 1);
+        a[i].len = fread(a[i].buf, 1, st.st_size, f);
+        fclose(f);
+        left -= a[i].len;
+        
+        /* Forms in a cache need no reading */
+        if (lcache_on && lcache_named(names[i]) && a[i].len <= LCACHE_MAX) {
+            double t = ltime_clock();
+            a[i].hash = lcache_hash(a[i].buf, a[i].len);
+            a[i].forms = lcache_load(names[i], a[i].len, a[i].hash);
+            ltime_read += ltime_clock() - t;
+            if (a[i].forms) { continue; }
+        }
+        
+        long rest;
+        int row = 0;
+        a[i].chunks = lpar_cut(names[i], a[i].buf, a[i].len, 0, 1,
+                &rest, &row);
+        lpar_submit(a[i].chunks);
     }
-    lval_del(a);
-    return lval_num(r);
+    return a;
 }
 
-/* Builtin Ordering Operators */
-lval* builtin_gt(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">");
+/* Whether a file still holds the "len" bytes at "buf" */
+static int lpar_same(const char* name, const char* buf, long len) {
+    FILE* f = fopen(name, "rb");
+    if (!f) { return 0; }
+    char* now = malloc(len + 1);
+    long n = fread(now, 1, len + 1, f);
+    fclose(f);
+    int same = n == len && memcmp(now, buf, len) == 0;
+    free(now);
+    return same;
 }
-lval* builtin_lt(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<");
+
+/* Cache the forms of a file read ahead once all are read, if reading */
+/* met no error */
+static void lpar_cache(const char* name, lahead* a) {
+    lcache_out o = { { NULL, 0, 0 }, NULL, 0, NULL, 0 };
+    long count = 0;
+    for (lchunk* c = a->chunks; c; c = c->next) {
+        lpar_wait(c);
+        if (c->err) {
+            lcache_out_free(&o);
+            return;
+        }
+        for (int i = 0; i < LCOUNT(c->forms); i++) {
+            lcache_put(&o, LCELL(c->forms)[i]);
+        }
+        count += LCOUNT(c->forms);
+    }
+    lcache_save(name, a->len, a->hash, &o, count);
+    lcache_out_free(&o);
 }
-lval* builtin_ge(lenv* e, lval* a) {
-    return builtin_ord(e, a, ">=");
+
+/* Read the "len" bytes at "s" as chunks on the reading threads, giving */
+/* all of their forms, or NULL on an error */
+lval* lpar_read_all(const char* name, const char* s, long len) {
+    long rest;
+    int row = 0;
+    lchunk* c = lpar_cut(name, s, len, 0, 1, &rest, &row);
+    lpar_submit(c);
+    
+    lval* x = lval_sexpr();
+    for (lchunk* d = c; d; d = d->next) {
+        lpar_wait(d);
+        if (d->err) {
+            lval_del(x);
+            x = NULL;
+            break;
+        }
+        for (int i = 0; i < LCOUNT(d->forms); i++) {
+            lval_add(x, LCELL(d->forms)[i]);
+        }
+        LCOUNT(d->forms) = 0;
+    }
+    lpar_free(c);
+    return x;
 }
-lval* builtin_le(lenv* e, lval* a) {
-    return builtin_ord(e, a, "<=");
+
+/* Run a file read ahead, or give NULL if it has changed since and */
+/* must be loaded again */
+lval* lpar_run(lenv* e, const char* name, lahead* a) {
+    lval* x = NULL;
+    if (lpar_same(name, a->buf, a->len)) {
+        if (a->forms) {
+            lval_run(e, a->forms);
+            x = lval_sexpr();
+        } else {
+            if (lcache_on && lcache_named(name) && a->len <= LCACHE_MAX) {
+                lpar_cache(name, a);
+            }
+            x = lpar_eval(e, a->chunks);
+            if (!x) { x = lval_sexpr(); }
+        }
+    }
+    if (a->forms) { lval_del(a->forms); }
+    lpar_free(a->chunks);
+    free(a->buf);
+    a->buf = NULL;
+    return x;
 }
 
-/* Equality comparison */
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-    LASSERT(a, a->count == 2,
-            "Function %s passed incorrect number of arguments. "
-            "Got %i, Expected 2.", op, 
-            a->count);
-    int r;
-    if (strcmp(op, "==") == 0) {
-        r =  lval_eq(a->cell[0], a->cell[1]);
+#endif
+
+/* Run a file from its cache, or read it whole and cache its forms */
+/* first. Gives NULL for a file not to be cached, or one with an error */
+/* in it, which are to be run as they are read. */
+lval* lcache_run(lenv* e, const char* name, FILE* f) {
+    struct stat st;
+    if (!lcache_on || !lcache_named(name) || fstat(fileno(f), &st) != 0 ||
+            !S_ISREG(st.st_mode) || st.st_size > LCACHE_MAX) {
+        return NULL;
+    }
+    
+    double t = ltime_clock();
+    char* buf = malloc(st.st_size + 1);
+    long len = fread(buf, 1, st.st_size, f);
+    uint64_t h = lcache_hash(buf, len);
+    lval* forms = lcache_load(name, len, h);
+    if (!forms) {
+#ifdef LPAR
+        if (lpar_threads > 1) {
+            forms = lpar_read_all(name, buf, len);
+        } else
+#endif
+        {
+            char* err = NULL;
+            forms = lread_all(name, buf, len, &err);
+            free(err);
+        }
+        
+        if (forms) {
+            lcache_out o = { { NULL, 0, 0 }, NULL, 0, NULL, 0 };
+            for (int i = 0; i < LCOUNT(forms); i++) { lcache_put(&o, LCELL(forms)[i]); }
+            lcache_save(name, len, h, &o, LCOUNT(forms));
+            lcache_out_free(&o);
+        }
     }
-    if (strcmp(op, "!=") == 0) {
-        r = !lval_eq(a->cell[0], a->cell[1]);
+    free(buf);
+    ltime_read += ltime_clock() - t;
+    
+    if (!forms) {
+        /* Start over, to run what comes before the error */
+        fseek(f, 0, SEEK_SET);
+        return NULL;
     }
-    lval_del(a);
-    return lval_num(r);
+    lval_run(e, forms);
+    lval_del(forms);
+    return lval_sexpr();
 }
 
-/* Equality builtin operators */
-lval* builtin_eq(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "==");
+/* Evaluate each Expression of a file as soon as it is read */
+lval* lval_load(lenv* e, const char* name, FILE* f, int lines) {
+#ifdef LPAR
+    if (!lines && lpar_threads > 1) { return lpar_load(e, name, f); }
+#endif
+    double t = ltime_clock();
+    lreader r;
+    lread_file(&r, name, f, lines);
+    
+    lval* expr;
+    while ((expr = lread_next(&r))) {
+        double u = ltime_clock();
+        ltime_read += u - t;
+        lval* x = lval_eval(e, expr);
+        /* If Evaluation leads to error print it */
+        if (LTYPE(x) == LVAL_ERR) { lval_println(x); }
+        lval_del(x);
+        lval_del(expr);
+        /* Whoever feeds in lines may be waiting on what they print */
+        if (lines) { fflush(stdout); }
+        t = ltime_clock();
+        ltime_eval += t - u;
+    }
+    ltime_read += ltime_clock() - t;
+    
+    /* Reading stops at an error, after what came before has been run */
+    lval* x = r.err ?
+        lval_err("Could not load Library: %s", r.err) : lval_sexpr();
+    lread_close(&r);
+    return x;
 }
 
-lval* builtin_ne(lenv* e, lval* a) {
-    return builtin_cmp(e, a, "!=");
+/* Read the first Expression of a String */
+lval* builtin_read(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(read, 1);
+    LASSERT_TYPE(read, 0, LVAL_STR);
+    
+    lreader r;
+    lread_init(&r, "<string>", LSTR(argv[0]), strlen(LSTR(argv[0])));
+    lval* x = lread_next(&r);
+    if (r.err) {
+        x = lval_err("Could not read: %s", r.err);
+    } else if (!x) {
+        x = lval_err("Function 'read' passed a String with no expression.");
+    } else if (LTYPE(x) == LVAL_SEXPR) {
+        /* Code comes as a Q-Expression, ready for eval */
+        x->type = LVAL_QEXPR;
+    }
+    lread_close(&r);
+    return x;
 }
 
-/* If expression */
-lval* builtin_if(lenv* e, lval* a) {
-    /* Check Three arguments, each of which are Numbers, and two Q-expression */
-    LASSERT(a, a->count == 3,
-            "Function if passed incorrect number of arguments. "
-            "Got %i, Expected 3.",
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_NUM,
-            "Function if passed incorrect type for argument 0. "
-            "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_NUM));
-    LASSERT(a, a->cell[1]->type == LVAL_QEXPR,
-            "Function if passed incorrect type for argument 1. "
-            "Got %s, Expected %s.",
-            ltype_name(a->cell[1]->type), ltype_name(LVAL_QEXPR));
-    LASSERT(a, a->cell[2]->type == LVAL_QEXPR,
-            "Function if passed incorrect type for argument 2. "
-            "Got %s, Expected %s.",
-            ltype_name(a->cell[2]->type), ltype_name(LVAL_QEXPR));
-    
-    /* Mark Both Expressions as evaluable */
-    lval* x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
+/* Read every Expression of a String into a Q-Expression */
+lval* builtin_read_all(lenv* e, int argc, lval** argv) {
+    LASSERT_ARGC(read-all, 1);
+    LASSERT_TYPE(read-all, 0, LVAL_STR);
     
-    if (a->cell[0]->num) {
-        /* If condition is true evaluate first expression */
-        x = lval_eval(e, lval_pop(a, 1));
-    } else {
-        /* Otherwise evaluate second expression */
-        x = lval_eval(e, lval_pop(a, 2));
+    char* err;
+    lval* x = lread_all("<string>", LSTR(argv[0]), strlen(LSTR(argv[0])), &err);
+    if (!x) {
+        x = lval_err("Could not read: %s", err);
+        free(err);
+        return x;
+    }
+    x->type = LVAL_QEXPR;
+    for (int i = 0; i < LCOUNT(x); i++) {
+        if (LTYPE(LCELL(x)[i]) == LVAL_SEXPR) { LCELL(x)[i]->type = LVAL_QEXPR; }
     }
-    
-    /* Delete argument list and return */
-    lval_del(a);
     return x;
 }
 
-lval* lval_eval(lenv*, lval*);
-
 /* Load a file */
-lval* builtin_load(lenv* e, lval* a) {
+lval* builtin_load(lenv* e, int argc, lval** argv) {
     /* Check One arguments, which is String */
-    LASSERT(a, a->count == 1,
+    LASSERT(argc == 1,
             "Function load passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_STR,
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_STR,
             "Function load passed incorrect type for argument 0. "
             "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_STR));
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_STR));
     
-    /* Parse File given by string name */
-    mpc_result_t r;
-    if (mpc_parse_contents(a->cell[0]->str, Lispy, &r)) {
-        
-        /* Read contents */
-        lval* expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
-        
-        /* Evaluate each Expression */
-        while (expr->count) {
-            lval* x = lval_eval(e, lval_pop(expr, 0));
-            /* If Evaluation leads to error print it */
-            if (x->type == LVAL_ERR) { lval_println(x); }
-            lval_del(x);
-        }
-        
-        /* Delete expressions and arguments */
-        lval_del(expr);
-        lval_del(a);
-        
-        /* Return empty list */
-        return lval_sexpr();
-        
-    } else {
-        /* Get Parse Error as String */
-        char* err_msg = mpc_err_string(r.error);
-        mpc_err_delete(r.error);
-        
-        /* Create new error message using it */
-        lval* err = lval_err("Could not load Library: %s", err_msg);
-        free(err_msg);
-        lval_del(a);
-        
-        /* Cleanup and return error */
-        return err;
+    /* Open File given by string name */
+    FILE* f = fopen(LSTR(argv[0]), "rb");
+    if (!f) {
+        return lval_err("Could not load Library: "
+                "%s: error: Unable to open file!\n", LSTR(argv[0]));
     }
+    
+    lval* x = lcache_run(e, LSTR(argv[0]), f);
+    if (!x) { x = lval_load(e, LSTR(argv[0]), f, 0); }
+    fclose(f);
+    return x;
 }
 
 /* Print a String */
-lval* builtin_print(lenv* e, lval* a) {
+lval* builtin_print(lenv* e, int argc, lval** argv) {
     
     /* Print each argument followed by a space */
-    for (int i = 0; i < a->count; i++) {
-        lval_print(a->cell[i]); putchar(' ');
+    for (int i = 0; i < argc; i++) {
+        lval_print(argv[i]); putchar(' ');
     }
     
-    /* Print a newline and delete arguments */
+    /* Print a newline */
     putchar('\n');
-    lval_del(a);
     
     return lval_sexpr();
 }
 
 /* Suppress an error */
-lval* builtin_error(lenv* e, lval* a) {
+lval* builtin_error(lenv* e, int argc, lval** argv) {
     /* Check One arguments, which is String */
-    LASSERT(a, a->count == 1,
+    LASSERT(argc == 1,
             "Function load passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_STR,
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_STR,
             "Function load passed incorrect type for argument 0. "
             "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_STR));
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_STR));
     
     /* Construct Error from first argument */
-    lval* err = lval_err(a->cell[0]->str);
-    
-    /* Delete arguments and return */
-    lval_del(a);
-    return err;
+    return lval_err(LSTR(argv[0]));
 }
 
 /* Double builtins */
 /* cast */
-lval* builtin_inttofloat(lenv* e, lval* a) {
+lval* builtin_inttofloat(lenv* e, int argc, lval** argv) {
     /* Check One arguments, which is Number */
-    LASSERT(a, a->count == 1,
+    LASSERT(argc == 1,
             "Function inttofloat passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
-    if (a->cell[0]->type == LVAL_DNUM) {
-        lval* dnum = lval_dnum(a->cell[0]->dnum);
-        lval_del(a);
-        return dnum;
+            argc);
+    if (LTYPE(argv[0]) == LVAL_DNUM) {
+        return lval_dnum(LDNUM(argv[0]));
     }
-    LASSERT(a, a->cell[0]->type == LVAL_NUM,
+    LASSERT(LTYPE(argv[0]) == LVAL_NUM,
             "Function inttofloat passed incorrect type for argument 0. "
             "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_NUM)); 
-    lval* dnum = lval_dnum(a->cell[0]->num);
-    lval_del(a);
-    return dnum;
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_NUM)); 
+    return lval_dnum(LNUM(argv[0]));
 }
-lval* builtin_floattoint(lenv* e, lval* a) {
+lval* builtin_floattoint(lenv* e, int argc, lval** argv) {
     /* Check One arguments, which is Number */
-    LASSERT(a, a->count == 1,
+    LASSERT(argc == 1,
             "Function floattoint passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
-    if (a->cell[0]->type == LVAL_NUM) {
-        lval* num = lval_num(a->cell[0]->num);
-        lval_del(a);
-        return num;
+            argc);
+    if (LTYPE(argv[0]) == LVAL_NUM) {
+        return lval_num(LNUM(argv[0]));
     }
-    LASSERT(a, a->cell[0]->type == LVAL_DNUM,
+    LASSERT(LTYPE(argv[0]) == LVAL_DNUM,
             "Function floattoint passed incorrect type for argument 0. "
             "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_DNUM)); 
-    lval* num = lval_num(a->cell[0]->dnum);
-    lval_del(a);
-    return num;
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_DNUM)); 
+    return lval_num(LDNUM(argv[0]));
 }
 
 /* ceil and floor and round */
-lval* builtin_ceil(lenv* e, lval* a) {
+lval* builtin_ceil(lenv* e, int argc, lval** argv) {
     /* Check One arguments, which is Number */
-    LASSERT(a, a->count == 1,
+    LASSERT(argc == 1,
             "Function ceil passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_DNUM,
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_DNUM,
             "Function ceil passed incorrect type for argument 0. "
             "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_DNUM)); 
-    lval* num = lval_num(ceil(a->cell[0]->dnum));
-    lval_del(a);
-    return num;
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_DNUM)); 
+    return lval_num(ceil(LDNUM(argv[0])));
 }
-lval* builtin_floor(lenv* e, lval* a) {
+lval* builtin_floor(lenv* e, int argc, lval** argv) {
     /* Check One arguments, which is Number */
-    LASSERT(a, a->count == 1,
+    LASSERT(argc == 1,
             "Function floor passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_DNUM,
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_DNUM,
             "Function floor passed incorrect type for argument 0. "
             "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_DNUM)); 
-    lval* num = lval_num(floor(a->cell[0]->dnum));
-    lval_del(a);
-    return num;
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_DNUM)); 
+    return lval_num(floor(LDNUM(argv[0])));
 }
-lval* builtin_round(lenv* e, lval* a) {
+lval* builtin_round(lenv* e, int argc, lval** argv) {
     /* Check One arguments, which is Number */
-    LASSERT(a, a->count == 1,
+    LASSERT(argc == 1,
             "Function round passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_DNUM,
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_DNUM,
             "Function round passed incorrect type for argument 0. "
             "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_DNUM)); 
-    lval* num = lval_num(round(a->cell[0]->dnum));
-    lval_del(a);
-    return num;
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_DNUM)); 
+    return lval_num(round(LDNUM(argv[0])));
 }
 
 /* Type Builtins */
-lval* builtin_typeof(lenv* e, lval* a) {
-    LASSERT(a, a->count == 1,
+lval* builtin_typeof(lenv* e, int argc, lval** argv) {
+    LASSERT(argc == 1,
             "Function typeof passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
+            argc);
+    
+    return lval_str(ltype_name(LTYPE(argv[0])));
+}
+
+/* Environment Builtins */
+/* Takes a dummy argument like quit, since (env-stats) alone is not a call */
+lval* builtin_env_stats(lenv* e, int argc, lval** argv) {
+    LASSERT(argc == 1,
+            "Function env-stats passed incorrect number of arguments. "
+            "Got %i, Expected 1.",
+            argc);
+    
+    /* Report on the global enviroment */
+    while (e->par) { e = e->par; }
+    
+    if (!e->index) {
+        printf("%i entries, linear search\n", e->count);
+    } else {
+        /* Count the slots probed to find each entry */
+        int mask = e->index_cap - 1;
+        long total = 0;
+        int longest = 0;
+        for (int i = 0; i < e->count; i++) {
+            int probes = 1;
+            int j = e->syms[i]->hash & mask;
+            while (e->index[j] != i + 1) { j = (j + 1) & mask; probes++; }
+            total += probes;
+            if (probes > longest) { longest = probes; }
+        }
+        printf("%i entries, %i slots, load %.2f, "
+                "average probe %.2f, longest probe %i\n",
+                e->count, e->index_cap, (double)e->count / e->index_cap,
+                (double)total / e->count, longest);
+    }
+    
+    return lval_sexpr();
+}
+
+/* Lambda calls running at once, and the most allowed before an error */
+#define LVM_MAX_DEPTH 10000000
+int lvm_depth = 0;
+int lvm_max_depth = LVM_MAX_DEPTH;
+
+/* Lambda calls themselves take no C stack, but evaluation nested in */
+/* builtins and eval does, so how much is in use is checked against */
+/* the limit on it before going deeper */
+static uintptr_t lstack_base = 0;
+static size_t lstack_max = 0;
+
+/* Note where the C stack starts and how far it may safely grow */
+void lstack_init(void* base) {
+    struct rlimit r;
+    size_t size = (size_t)8 << 20;
+    if (getrlimit(RLIMIT_STACK, &r) == 0) {
+        size = r.rlim_cur == RLIM_INFINITY ? (size_t)256 << 20 : r.rlim_cur;
+    }
+    /* Leaving a quarter for builtins working at the deepest point */
+    lstack_max = size - size / 4;
+    lstack_base = (uintptr_t)base;
+}
+
+/* Whether the C stack has grown past what is safe */
+static inline int lstack_full(void) {
+    char here;
+    uintptr_t p = (uintptr_t)&here;
+    return lstack_base &&
+        (lstack_base > p ? lstack_base - p : p - lstack_base) > lstack_max;
+}
+
+#define LSTACK_ERR "Maximum depth of nested evaluation exceeded"
+
+/* Set the maximum depth of lambda calls */
+lval* builtin_max_depth(lenv* e, int argc, lval** argv) {
+    LASSERT(argc == 1,
+            "Function max-depth passed incorrect number of arguments. "
+            "Got %i, Expected 1.",
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_NUM,
+            "Function max-depth passed incorrect type for argument 0. "
+            "Got %s, Expected %s.",
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_NUM));
+    LASSERT(LNUM(argv[0]) > 0 && LNUM(argv[0]) <= INT_MAX,
+            "Function max-depth passed invalid depth %li.",
+            LNUM(argv[0]));
     
-    return lval_str(ltype_name(a->cell[0]->type));
+    lvm_max_depth = LNUM(argv[0]);
+    return lval_sexpr();
 }
 
 /* Quit */
-lval* builtin_quit(lenv* e, lval* a) {
-    LASSERT(a, a->count == 1,
+lval* builtin_quit(lenv* e, int argc, lval** argv) {
+    LASSERT(argc == 1,
             "Function quit passed incorrect number of arguments. "
             "Got %i, Expected 1.",
-            a->count);
-    LASSERT(a, a->cell[0]->type == LVAL_NUM,
+            argc);
+    LASSERT(LTYPE(argv[0]) == LVAL_NUM,
             "Function quit passed incorrect type for argument 0. "
             "Got %s, Expected %s.",
-            ltype_name(a->cell[0]->type), ltype_name(LVAL_NUM)); 
+            ltype_name(LTYPE(argv[0])), ltype_name(LVAL_NUM)); 
     
-    exit(a->cell[0]->num);
+    exit(LNUM(argv[0]));
 }
 
 /* add a builtin */
@@ -1274,6 +5661,71 @@ void lenv_add_builtins(lenv* e) {
     lenv_add_builtin(e, "eval", builtin_eval);
     lenv_add_builtin(e, "join", builtin_join);
     
+    /* Prelude List Functions */
+    lenv_add_builtin(e, "len", builtin_len);
+    lenv_add_builtin(e, "nth", builtin_nth);
+    lenv_add_builtin(e, "last", builtin_last);
+    lenv_add_builtin(e, "take", builtin_take);
+    lenv_add_builtin(e, "drop", builtin_drop);
+    lenv_add_builtin(e, "split", builtin_split);
+    lenv_add_builtin(e, "elem", builtin_elem);
+    lenv_add_builtin(e, "reverse", builtin_reverse);
+    lenv_add_builtin(e, "map", builtin_map);
+    lenv_add_builtin(e, "fliter", builtin_fliter);
+    lenv_add_builtin(e, "foldl", builtin_foldl);
+    lenv_add_builtin(e, "foldr", builtin_foldr);
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "product", builtin_product);
+    
+    /* Vector Functions */
+    lenv_add_builtin(e, "vec", builtin_vec);
+    lenv_add_builtin(e, "range", builtin_range);
+    lenv_add_builtin(e, "list->vec", builtin_list_to_vec);
+    lenv_add_builtin(e, "vec->list", builtin_vec_to_list);
+    lenv_add_builtin(e, "vsum", builtin_vsum);
+    lenv_add_builtin(e, "vprod", builtin_vprod);
+    lenv_add_builtin(e, "vmin", builtin_vmin);
+    lenv_add_builtin(e, "vmax", builtin_vmax);
+    lenv_add_builtin(e, "vdot", builtin_vdot);
+    lenv_add_builtin(e, "v+", builtin_vadd);
+    lenv_add_builtin(e, "v-", builtin_vsub);
+    lenv_add_builtin(e, "v*", builtin_vmul);
+    lenv_add_builtin(e, "v/", builtin_vdiv);
+    
+    /* Matrix Functions */
+    lenv_add_builtin(e, "mat", builtin_mat);
+    lenv_add_builtin(e, "mref", builtin_mref);
+    lenv_add_builtin(e, "mset", builtin_mset);
+    lenv_add_builtin(e, "mshape", builtin_mshape);
+    lenv_add_builtin(e, "matmul", builtin_matmul);
+    lenv_add_builtin(e, "transpose", builtin_transpose);
+    lenv_add_builtin(e, "mrow", builtin_mrow);
+    lenv_add_builtin(e, "mcol", builtin_mcol);
+    lenv_add_builtin(e, "mrowsum", builtin_mrowsum);
+    lenv_add_builtin(e, "mcolsum", builtin_mcolsum);
+    
+    /* Array Functions */
+    lenv_add_builtin(e, "array", builtin_array);
+    lenv_add_builtin(e, "aget", builtin_aget);
+    lenv_add_builtin(e, "aset!", builtin_aset);
+    lenv_add_builtin(e, "alen", builtin_alen);
+    lenv_add_builtin(e, "afill!", builtin_afill);
+    lenv_add_builtin(e, "acopy", builtin_acopy);
+    lenv_add_builtin(e, "apush!", builtin_apush);
+    
+    /* Map Functions */
+    lenv_add_builtin(e, "map-new", builtin_map_new);
+    lenv_add_builtin(e, "map-get", builtin_map_get);
+    lenv_add_builtin(e, "map-assoc", builtin_map_assoc);
+    lenv_add_builtin(e, "map-dissoc", builtin_map_dissoc);
+    lenv_add_builtin(e, "map-keys", builtin_map_keys);
+    lenv_add_builtin(e, "map-count", builtin_map_count);
+    lenv_add_builtin(e, "map-fold", builtin_map_fold);
+    
+    /* Memo Functions */
+    lenv_add_builtin(e, "memo", builtin_memo);
+    lenv_add_builtin(e, "memo-stats", builtin_memo_stats);
+    
     /* Mathematical Functions */
     lenv_add_builtin(e, "+", builtin_add);
     lenv_add_builtin(e, "-", builtin_sub);
@@ -1296,6 +5748,8 @@ void lenv_add_builtins(lenv* e) {
     
     /* String Functions */
     lenv_add_builtin(e, "load", builtin_load);
+    lenv_add_builtin(e, "read", builtin_read);
+    lenv_add_builtin(e, "read-all", builtin_read_all);
     lenv_add_builtin(e, "error", builtin_error);
     lenv_add_builtin(e, "print", builtin_print);
     
@@ -1309,59 +5763,827 @@ void lenv_add_builtins(lenv* e) {
     /* Type Functions */
     lenv_add_builtin(e, "typeof", builtin_typeof);
     
+    /* Enviroment Functions */
+    lenv_add_builtin(e, "env-stats", builtin_env_stats);
+    lenv_add_builtin(e, "max-depth", builtin_max_depth);
+    
     /* Quit */
     lenv_add_builtin(e, "quit", builtin_quit);
 }
 
-/* Eval an Sexpr "lval" */
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-    
-    /* Evaluate Children */
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+/* Bytecode Compiler */
+/* Lambda bodies are compiled on their first call into direct-threaded */
+/* code run over an explicit value stack. Calls to the arithmetic and */
+/* comparison operators, head, tail and if get their own instructions, */
+/* which check at run time that the name still holds that builtin and */
+/* otherwise make the same call the tree walker would. A call to a */
+/* lambda right before returning reuses the running machine, and other */
+/* calls to lambdas save the caller on a heap stack rather than recurse. */
+enum { LOP_CONST, LOP_LOCAL, LOP_GLOBAL, LOP_CALL, LOP_JMP, LOP_IF,
+       LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_GT, LOP_LT, LOP_GE, LOP_LE,
+       LOP_EQ, LOP_NE, LOP_HEAD, LOP_TAIL, LOP_LAMBDA, LOP_RET, LOP_COUNT };
+
+/* Operand words following each instruction */
+static const int lop_args[LOP_COUNT] = {
+    1, 1, 1, 1, 1, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0 };
+
+/* Builtin calls with their own instruction, found by name and arity */
+static struct { char* name; int argc; int op; lsym* sym; } lop_builtins[] = {
+    { "+", 2, LOP_ADD }, { "-", 2, LOP_SUB },
+    { "*", 2, LOP_MUL }, { "/", 2, LOP_DIV },
+    { ">", 2, LOP_GT }, { "<", 2, LOP_LT },
+    { ">=", 2, LOP_GE }, { "<=", 2, LOP_LE },
+    { "==", 2, LOP_EQ }, { "!=", 2, LOP_NE },
+    { "head", 1, LOP_HEAD }, { "tail", 1, LOP_TAIL },
+    { "if", 3, LOP_IF },
+};
+
+/* One word of code, an instruction's label or one of its operands */
+typedef union linstr { void* label; long arg; } linstr;
+
+/* Declare New lcode Struct, a compiled lambda body */
+struct lcode {
+    /* Id of the scope whose slot Symbols are read directly */
+    unsigned long scope;
+    int count;
+    int cap;
+    linstr* code;
+    int nconsts;
+    lval** consts;
+    /* Value stack depth while compiling, and the most it reaches */
+    int depth;
+    int max_depth;
+};
+
+/* Append a word of code */
+void lcode_emit(lcode* c, long w) {
+    if (c->count == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->code = realloc(c->code, sizeof(linstr) * c->cap);
     }
-    
-    /* Error Checking */
-    for (int i = 0; i < v->count; i++) {
-        if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    c->code[c->count++].arg = w;
+}
+
+/* Add a constant, returning its index */
+long lcode_const(lcode* c, lval* v) {
+    c->consts = realloc(c->consts, sizeof(lval*) * (c->nconsts + 1));
+    c->consts[c->nconsts] = lval_ref(v);
+    return c->nconsts++;
+}
+
+/* Track the value stack depth as instructions push and pop */
+void lcode_push(lcode* c, int n) {
+    c->depth += n;
+    if (c->depth > c->max_depth) { c->max_depth = c->depth; }
+}
+
+void lcode_list(lcode* c, lval* x, int tail);
+
+/* Compile code pushing the value of "x", returned at once if "tail" */
+void lcode_expr(lcode* c, lval* x, int tail) {
+    switch (LTYPE(x)) {
+        case LVAL_SYM:
+            if (!LVAL_IMM(x) && x->u.local.scope == c->scope) {
+                lcode_emit(c, LOP_LOCAL);
+                lcode_emit(c, x->u.local.slot);
+            } else {
+                lcode_emit(c, LOP_GLOBAL);
+                lcode_emit(c, lcode_const(c, x));
+            }
+            lcode_push(c, 1);
+            break;
+        case LVAL_SEXPR: lcode_list(c, x, tail); break;
+        default:
+            lcode_emit(c, LOP_CONST);
+            lcode_emit(c, lcode_const(c, x));
+            lcode_push(c, 1);
+            break;
     }
+}
+
+/* Compile code pushing the value of the cells of "x" as an S-Expression */
+void lcode_list(lcode* c, lval* x, int tail) {
     
     /* Empty Expression */
-    if (v->count == 0) { return v; }
+    if (LCOUNT(x) == 0) {
+        lval* v = lval_sexpr();
+        lcode_emit(c, LOP_CONST);
+        lcode_emit(c, lcode_const(c, v));
+        lcode_push(c, 1);
+        lval_del(v);
+        return;
+    }
     
     /* Single Expression */
-    if (v->count == 1) { return lval_take(v, 0); }
+    if (LCOUNT(x) == 1) { lcode_expr(c, LCELL(x)[0], tail); return; }
+    
+    /* Look for a builtin with its own instruction */
+    int op = LOP_CALL;
+    if (LVAL_IMM(LCELL(x)[0]) == LVAL_IMM_SYM) {
+        int n = sizeof(lop_builtins) / sizeof(lop_builtins[0]);
+        for (int i = 0; i < n; i++) {
+            if (!lop_builtins[i].sym) {
+                lop_builtins[i].sym = lsym_intern(lop_builtins[i].name);
+            }
+            if (LSYMID(LCELL(x)[0]) == lop_builtins[i].sym &&
+                    LCOUNT(x) - 1 == lop_builtins[i].argc) {
+                op = lop_builtins[i].op;
+            }
+        }
+    }
+    
+    /* Branches of if are compiled inline when given literally */
+    if (op == LOP_IF && LTYPE(LCELL(x)[2]) == LVAL_QEXPR &&
+            LTYPE(LCELL(x)[3]) == LVAL_QEXPR) {
+        lcode_expr(c, LCELL(x)[0], 0);
+        lcode_expr(c, LCELL(x)[1], 0);
+        lcode_emit(c, LOP_IF);
+        lcode_emit(c, lcode_const(c, LCELL(x)[2]));
+        lcode_emit(c, lcode_const(c, LCELL(x)[3]));
+        int at = c->count;
+        lcode_emit(c, 0);
+        lcode_emit(c, 0);
+        
+        /* Falling back to a call pushes both branches */
+        lcode_push(c, 2);
+        c->depth -= 4;
+        
+        /* In tail position the then branch returns instead of jumping */
+        lcode_list(c, LCELL(x)[2], tail);
+        int jmp = -1;
+        if (tail) {
+            lcode_emit(c, LOP_RET);
+        } else {
+            lcode_emit(c, LOP_JMP);
+            jmp = c->count;
+            lcode_emit(c, 0);
+        }
+        c->depth--;
+        
+        c->code[at].arg = c->count;
+        lcode_list(c, LCELL(x)[3], tail);
+        c->code[at + 1].arg = c->count;
+        if (jmp >= 0) { c->code[jmp].arg = c->count; }
+        return;
+    }
+    if (op == LOP_IF) { op = LOP_CALL; }
+    
+    /* Lambdas written out literally are laid out once, here, so every */
+    /* lambda made from them shares one scope and its compiled body */
+    static lsym* lambda = NULL;
+    if (!lambda) { lambda = lsym_intern("\\"); }
+    if (LVAL_IMM(LCELL(x)[0]) == LVAL_IMM_SYM && LSYMID(LCELL(x)[0]) == lambda &&
+            LCOUNT(x) == 3 && LTYPE(LCELL(x)[1]) == LVAL_QEXPR &&
+            LTYPE(LCELL(x)[2]) == LVAL_QEXPR) {
+        int syms = 1;
+        for (int i = 0; i < LCOUNT(LCELL(x)[1]); i++) {
+            if (LTYPE(LCELL(LCELL(x)[1])[i]) != LVAL_SYM) { syms = 0; }
+        }
+        if (syms) {
+            lval* proto = lval_lambda(lval_ref(LCELL(x)[1]), lval_ref(LCELL(x)[2]));
+            lcode_expr(c, LCELL(x)[0], 0);
+            lcode_emit(c, LOP_LAMBDA);
+            lcode_emit(c, lcode_const(c, proto));
+            lcode_emit(c, lcode_const(c, LCELL(x)[1]));
+            lcode_emit(c, lcode_const(c, LCELL(x)[2]));
+            lval_del(proto);
+            /* Falling back to a call pushes the formals and body */
+            lcode_push(c, 2);
+            c->depth -= 2;
+            return;
+        }
+    }
+    
+    /* Push the function and arguments, then call */
+    for (int i = 0; i < LCOUNT(x); i++) { lcode_expr(c, LCELL(x)[i], 0); }
+    lcode_emit(c, op);
+    if (op == LOP_CALL) { lcode_emit(c, LCOUNT(x) - 1); }
+    c->depth -= LCOUNT(x) - 1;
+}
+
+lval* lvm_exec(lenv*, lcode*);
+lval* lval_eval_call(lenv*, lval*, int*);
+
+/* Compile the body of a lambda with scope "s" */
+lcode* lcode_new(lscope* s, lval* body) {
+    lcode* c = calloc(1, sizeof(lcode));
+    c->scope = s->id;
+    lcode_list(c, body, 1);
+    lcode_emit(c, LOP_RET);
+    
+    /* Thread the code by replacing each opcode with its label */
+    static void** labels = NULL;
+    if (!labels) { labels = (void**)lvm_exec(NULL, NULL); }
+    for (int i = 0; i < c->count; ) {
+        int op = c->code[i].arg;
+        c->code[i].label = labels[op];
+        i += 1 + lop_args[op];
+    }
+    return c;
+}
+
+/* Delete a compiled body */
+void lcode_del(lcode* c) {
+    for (int i = 0; i < c->nconsts; i++) { lval_del(c->consts[i]); }
+    free(c->consts);
+    free(c->code);
+    free(c);
+}
+
+/* Virtual Machine */
+/* Value stack shared by every running body, "lvm_top" is the first */
+/* free entry whenever control may leave the machine. Arguments lent */
+/* to a builtin stay below it until the builtin returns, though they */
+/* may move once it evaluates anything. */
+static lval** lvm_stack = NULL;
+static int lvm_cap = 0;
+static int lvm_top = 0;
+
+/* Saved state of a body waiting on a lambda it called */
+typedef struct lvm_frame {
+    lcode* code;
+    linstr* pc;
+    lenv* env;
+    lenv* outer;
+    int base;
+} lvm_frame;
+
+/* Stack of waiting bodies shared by every running machine */
+static lvm_frame* lvm_frames = NULL;
+static int lvm_frames_cap = 0;
+static int lvm_nframes = 0;
+
+/* Make sure the value stack has "n" entries */
+void lvm_reserve(int n) {
+    if (n <= lvm_cap) { return; }
+    while (n > lvm_cap) { lvm_cap = lvm_cap ? lvm_cap * 2 : 1024; }
+    lvm_stack = realloc(lvm_stack, sizeof(lval*) * lvm_cap);
+}
+
+/* Check the function "args[0]" can be called on the "n" values after */
+/* it as lval_eval_sexpr would, returning NULL or the error consuming all */
+lval* lvm_check(lval** args, int n) {
+    
+    /* Error Checking */
+    for (int i = 0; i <= n; i++) {
+        if (LTYPE(args[i]) == LVAL_ERR) {
+            lval* err = args[i];
+            for (int j = 0; j <= n; j++) {
+                if (j != i) { lval_del(args[j]); }
+            }
+            return err;
+        }
+    }
     
     /* Ensure First Element is a Function after evaluation */
-    lval* f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval_del(f); lval_del(v);
-        return lval_err("Function 'eval' got incorrect type after evaluation for argument 1. "
+    lval* f = args[0];
+    if (LTYPE(f) != LVAL_FUN) {
+        lval* err = lval_err("Function 'eval' got incorrect type after evaluation for argument 1. "
+                "Got %s, Expected %s.",
+                ltype_name(LTYPE(f)), ltype_name(LVAL_FUN));
+        for (int i = 0; i <= n; i++) { lval_del(args[i]); }
+        return err;
+    }
+    return NULL;
+}
+
+/* Delete the "n" values from "args" on */
+void lvm_del(lval** args, int n) {
+    for (int i = 0; i < n; i++) { lval_del(args[i]); }
+}
+
+/* Check every binding of the frame "e" is hidden by one in "n" */
+int lenv_shadows(lenv* n, lenv* e) {
+    if (n->scope == e->scope && e->syms == e->scope->syms) { return 1; }
+    for (int i = 0; i < e->count; i++) {
+        int j = lenv_find(n, e->syms[i]);
+        if (j < 0 || !n->vals[j]) { return 0; }
+    }
+    return 1;
+}
+
+/* Run compiled code in the frame "e", deleting it when done */
+/* Called with no code it returns the label of each instruction instead */
+lval* lvm_exec(lenv* e, lcode* c) {
+    static void* labels[LOP_COUNT] = {
+        &&op_const, &&op_local, &&op_global, &&op_call, &&op_jmp, &&op_if,
+        &&op_add, &&op_sub, &&op_mul, &&op_div,
+        &&op_gt, &&op_lt, &&op_ge, &&op_le, &&op_eq, &&op_ne,
+        &&op_head, &&op_tail, &&op_lambda, &&op_ret };
+    if (!c) { return (lval*)labels; }
+    
+    /* Refuse to go deeper than the limit */
+    if (lvm_depth >= lvm_max_depth) {
+        lenv_del(e);
+        return lval_err("Maximum depth of %i lambda calls exceeded",
+                lvm_max_depth);
+    }
+    if (lstack_full()) {
+        lenv_del(e);
+        return lval_err(LSTACK_ERR);
+    }
+    lvm_depth++;
+    
+    /* Make room for everything this body pushes */
+    int base = lvm_top;
+    lvm_reserve(base + c->max_depth);
+    
+    /* Frames kept alive by tail calls chain back to the caller's */
+    lenv* outer = e->par;
+    
+    /* Bodies this machine is running below the current one */
+    int entry = lvm_nframes;
+    
+    lval** sp = lvm_stack + base;
+    linstr* pc = c->code;
+    lval* f; lval* x; lval* y; lval* r;
+    lenv* frame;
+    int n, at;
+    
+    #define LVM_NEXT goto *(pc++)->label
+    #define LVM_IS(f, fn) (LTYPE(f) == LVAL_FUN && LBUILTIN(f) == (fn))
+    
+    LVM_NEXT;
+    
+op_const:
+    *sp++ = lval_ref(c->consts[pc->arg]);
+    pc++;
+    LVM_NEXT;
+    
+op_local:
+    *sp++ = lval_ref(e->vals[pc->arg]);
+    pc++;
+    LVM_NEXT;
+    
+op_global:
+    *sp++ = lenv_get(e, c->consts[pc->arg]);
+    pc++;
+    LVM_NEXT;
+    
+op_call:
+    n = pc->arg;
+    pc++;
+call:
+    /* Function and "n" arguments are on top of the stack */
+    sp -= n + 1;
+    lvm_top = sp - lvm_stack;
+    r = lvm_check(sp, n);
+    if (r) { goto push; }
+    f = sp[0];
+    
+    /* Tail call to a lambda, run it in place of this body */
+    if (pc->label == labels[LOP_RET] && !LBUILTIN(f)) {
+        frame = lval_bind(f, n, sp + 1, &r);
+        lvm_del(sp + 1, n);
+        if (!frame) { lval_del(f); goto push; }
+        
+        /* The current frame is only kept if the callee could see into it */
+        if (lenv_shadows(frame, e)) {
+            frame->par = e->par;
+            lenv_del(e);
+        } else {
+            frame->par = e;
+        }
+        e = frame;
+        
+        if (!e->scope->code) { e->scope->code = lcode_new(e->scope, LBODY(f)); }
+        c = e->scope->code;
+        lval_del(f);
+        lvm_reserve(base + c->max_depth);
+        sp = lvm_stack + base;
+        pc = c->code;
+        LVM_NEXT;
+    }
+    
+    /* Tail call to eval, run what it is given up to the call that ends */
+    /* it and make that call in its place, so loops through eval stay */
+    /* in this body */
+    if (pc->label == labels[LOP_RET] && LBUILTIN(f) == builtin_eval &&
+            !LMEMO(f) && n == 1 && LTYPE(sp[1]) == LVAL_QEXPR) {
+        at = lvm_top;
+        lvm_top = at + 2;
+        r = lval_eval_call(e, sp[1], &n);
+        sp = lvm_stack + at;
+        lval_del(sp[0]);
+        lval_del(sp[1]);
+        lvm_top = at;
+        if (r) { goto push; }
+        
+        /* The function and arguments it ends in move down to here */
+        memmove(sp, sp + 2, sizeof(lval*) * n);
+        sp += n;
+        n--;
+        goto call;
+    }
+    
+    /* Other calls to lambdas save this body and start the callee */
+    if (!LBUILTIN(f)) {
+        frame = lval_bind(f, n, sp + 1, &r);
+        lvm_del(sp + 1, n);
+        if (!frame) { lval_del(f); goto push; }
+        if (lvm_depth >= lvm_max_depth) {
+            lenv_del(frame); lval_del(f);
+            r = lval_err("Maximum depth of %i lambda calls exceeded",
+                    lvm_max_depth);
+            goto push;
+        }
+        lvm_depth++;
+        
+        if (lvm_nframes == lvm_frames_cap) {
+            lvm_frames_cap = lvm_frames_cap ? lvm_frames_cap * 2 : 256;
+            lvm_frames = realloc(lvm_frames,
+                    sizeof(lvm_frame) * lvm_frames_cap);
+        }
+        lvm_frame* s = &lvm_frames[lvm_nframes++];
+        s->code = c; s->pc = pc; s->env = e; s->outer = outer; s->base = base;
+        
+        /* The callee's value lands where the function was */
+        frame->par = e;
+        outer = e;
+        e = frame;
+        base = lvm_top;
+        
+        if (!e->scope->code) { e->scope->code = lcode_new(e->scope, LBODY(f)); }
+        c = e->scope->code;
+        lval_del(f);
+        lvm_reserve(base + c->max_depth);
+        sp = lvm_stack + base;
+        pc = c->code;
+        LVM_NEXT;
+    }
+    
+    /* Builtins borrow the function and arguments left on the stack */
+    at = lvm_top;
+    lvm_top = at + n + 1;
+    r = LMEMO(f) ? lmemo_call(e, f, n, sp + 1) : LBUILTIN(f)(e, n, sp + 1);
+    /* The stack may have moved while the call ran */
+    sp = lvm_stack + at;
+    lvm_del(sp, n + 1);
+    lvm_top = at;
+push:
+    *sp++ = r;
+    LVM_NEXT;
+    
+op_jmp:
+    pc = c->code + pc->arg;
+    LVM_NEXT;
+    
+op_if:
+    f = sp[-2]; x = sp[-1];
+    if (LVM_IS(f, builtin_if) && LTYPE(x) == LVAL_NUM) {
+        /* Then branch follows, else branch is at the first operand */
+        long cond = LNUM(x);
+        lval_del(f); lval_del(x);
+        sp -= 2;
+        pc = cond ? pc + 4 : c->code + pc[2].arg;
+        LVM_NEXT;
+    }
+    *sp++ = lval_ref(c->consts[pc[0].arg]);
+    *sp++ = lval_ref(c->consts[pc[1].arg]);
+    pc = c->code + pc[3].arg;
+    n = 3;
+    goto call;
+    
+    /* Binary arithmetic and orderings on two numbers of the same type */
+    /* run the builtin's kernel, which also reports overflow and division */
+    /* by zero */
+    #define LVM_ARITH(fn, num, dnum) \
+        f = sp[-3]; x = sp[-2]; y = sp[-1]; \
+        if (!LVM_IS(f, fn)) { n = 2; goto call; } \
+        if (LTYPE(x) == LVAL_NUM && LTYPE(y) == LVAL_NUM) { \
+            r = num(2, sp - 2); goto binary; \
+        } \
+        if (LTYPE(x) == LVAL_DNUM && LTYPE(y) == LVAL_DNUM) { \
+            r = dnum(2, sp - 2); goto binary; \
+        } \
+        n = 2; goto call;
+    
+op_add: LVM_ARITH(builtin_add, lkernel_add, lkernel_add_double)
+op_sub: LVM_ARITH(builtin_sub, lkernel_sub, lkernel_sub_double)
+op_mul: LVM_ARITH(builtin_mul, lkernel_mul, lkernel_mul_double)
+op_div: LVM_ARITH(builtin_div, lkernel_div, lkernel_div_double)
+op_gt: LVM_ARITH(builtin_gt, lkernel_gt, lkernel_gt_double)
+op_lt: LVM_ARITH(builtin_lt, lkernel_lt, lkernel_lt_double)
+op_ge: LVM_ARITH(builtin_ge, lkernel_ge, lkernel_ge_double)
+op_le: LVM_ARITH(builtin_le, lkernel_le, lkernel_le_double)
+    
+op_eq:
+    f = sp[-3]; x = sp[-2]; y = sp[-1];
+    if (!LVM_IS(f, builtin_eq)) { n = 2; goto call; }
+    r = lval_num(lval_eq(x, y));
+    goto binary;
+    
+op_ne:
+    f = sp[-3]; x = sp[-2]; y = sp[-1];
+    if (!LVM_IS(f, builtin_ne)) { n = 2; goto call; }
+    r = lval_num(!lval_eq(x, y));
+    goto binary;
+    
+binary:
+    lval_del(f); lval_del(x); lval_del(y);
+    sp -= 3;
+    *sp++ = r;
+    LVM_NEXT;
+    
+op_head:
+    f = sp[-2]; x = sp[-1];
+    if (!LVM_IS(f, builtin_head) || LTYPE(x) != LVAL_QEXPR ||
+            LCOUNT(x) == 0) { n = 1; goto call; }
+    r = lval_add(lval_qexpr(), lval_ref(LCELL(x)[0]));
+    goto unary;
+    
+op_tail:
+    f = sp[-2]; x = sp[-1];
+    if (!LVM_IS(f, builtin_tail) || LTYPE(x) != LVAL_QEXPR ||
+            LCOUNT(x) == 0) { n = 1; goto call; }
+    r = lval_slice(x, 1, LCOUNT(x));
+    goto unary;
+    
+op_lambda:
+    f = sp[-1];
+    if (!LVM_IS(f, builtin_lambda)) {
+        *sp++ = lval_ref(c->consts[pc[1].arg]);
+        *sp++ = lval_ref(c->consts[pc[2].arg]);
+        pc += 3;
+        n = 2;
+        goto call;
+    }
+    /* A new lambda with its own frame, sharing the rest */
+    x = c->consts[pc->arg];
+    r = lval_alloc();
+    r->type = LVAL_FUN;
+    r->rc = 1;
+    LBUILTIN(r) = NULL;
+    LENV(r) = lenv_frame(LENV(x)->scope);
+    LFORMALS(r) = lval_ref(LFORMALS(x));
+    LBODY(r) = lval_ref(LBODY(x));
+    lval_del(f);
+    sp[-1] = r;
+    pc += 3;
+    LVM_NEXT;
+    
+unary:
+    lval_del(f); lval_del(x);
+    sp -= 2;
+    *sp++ = r;
+    LVM_NEXT;
+    
+op_ret:
+    r = *--sp;
+    /* Delete the frame and any kept for tail calls */
+    while (e != outer) {
+        frame = e->par;
+        lenv_del(e);
+        e = frame;
+    }
+    lvm_depth--;
+    
+    /* Resume the waiting caller with the value */
+    if (lvm_nframes > entry) {
+        sp = lvm_stack + base;
+        lvm_frame* s = &lvm_frames[--lvm_nframes];
+        c = s->code; pc = s->pc; e = s->env; outer = s->outer; base = s->base;
+        *sp++ = r;
+        LVM_NEXT;
+    }
+    lvm_top = base;
+    return r;
+    
+    #undef LVM_NEXT
+    #undef LVM_IS
+    #undef LVM_ARITH
+}
+
+/* Evaluate the body of a lambda in its bound frame "e", deleting it */
+lval* lcode_run(lenv* e, lval* body) {
+    if (!e->scope->code) { e->scope->code = lcode_new(e->scope, body); }
+    return lvm_exec(e, e->scope->code);
+}
+
+/* Special Forms */
+/* Calls to if, \, def and = with their quoted arguments written out */
+/* literally read those arguments from the code in place rather than */
+/* evaluating and copying them. A form returns its value, or NULL with */
+/* "next" set to an expression to continue with in tail position, or */
+/* NULL alone to leave a call it does not handle to the usual path. */
+typedef lval*(*lspecial)(lenv*, lval*, lval**);
+
+/* Evaluate only the condition, then continue with the chosen branch */
+lval* lspecial_if(lenv* e, lval* v, lval** next) {
+    if (LCOUNT(v) != 4 || LTYPE(LCELL(v)[2]) != LVAL_QEXPR ||
+            LTYPE(LCELL(v)[3]) != LVAL_QEXPR) { return NULL; }
+    
+    lval* c = lval_eval(e, LCELL(v)[1]);
+    if (LTYPE(c) == LVAL_ERR) { return c; }
+    if (LTYPE(c) != LVAL_NUM) {
+        lval* err = lval_err("Function if passed incorrect type for argument 0. "
                 "Got %s, Expected %s.",
-                ltype_name(f->type), ltype_name(LVAL_FUN));
+                ltype_name(LTYPE(c)), ltype_name(LVAL_NUM));
+        lval_del(c);
+        return err;
+    }
+    
+    *next = lval_ref(LCELL(v)[LNUM(c) ? 2 : 3]);
+    lval_del(c);
+    return NULL;
+}
+
+/* Build the lambda straight from the formals and body in the code */
+lval* lspecial_lambda(lenv* e, lval* v, lval** next) {
+    if (LCOUNT(v) != 3 || LTYPE(LCELL(v)[1]) != LVAL_QEXPR ||
+            LTYPE(LCELL(v)[2]) != LVAL_QEXPR) { return NULL; }
+    for (int i = 0; i < LCOUNT(LCELL(v)[1]); i++) {
+        if (LTYPE(LCELL(LCELL(v)[1])[i]) != LVAL_SYM) { return NULL; }
+    }
+    return lval_lambda(lval_ref(LCELL(v)[1]), lval_ref(LCELL(v)[2]));
+}
+
+/* Evaluate only the values, sharing the list of names from the code */
+lval* lspecial_var(lenv* e, lval* v, lbuiltin func) {
+    if (LCOUNT(v) < 2 || LTYPE(LCELL(v)[1]) != LVAL_QEXPR) { return NULL; }
+    
+    /* Names and values go on the stack for the builtin to borrow */
+    int n = LCOUNT(v) - 1;
+    int base = lvm_top;
+    lvm_reserve(base + n);
+    lvm_stack[lvm_top++] = lval_ref(LCELL(v)[1]);
+    for (int i = 2; i < LCOUNT(v); i++) {
+        lval* x = lval_eval(e, LCELL(v)[i]);
+        lvm_stack[lvm_top++] = x;
     }
     
-    /* Call builtin with operator */
-    lval* result = lval_call(e, f, v);
+    lval* r = NULL;
+    for (int i = 1; i < n; i++) {
+        if (LTYPE(lvm_stack[base + i]) == LVAL_ERR) {
+            r = lval_ref(lvm_stack[base + i]);
+            break;
+        }
+    }
+    if (!r) { r = func(e, n, lvm_stack + base); }
+    lvm_del(lvm_stack + base, n);
+    lvm_top = base;
+    return r;
+}
+
+lval* lspecial_def(lenv* e, lval* v, lval** next) {
+    return lspecial_var(e, v, builtin_def);
+}
+
+lval* lspecial_put(lenv* e, lval* v, lval** next) {
+    return lspecial_var(e, v, builtin_put);
+}
+
+/* Special forms by head symbol, and the builtin it must still hold */
+static struct { char* name; lbuiltin func; lspecial form; } lspecials[] = {
+    { "if", builtin_if, lspecial_if },
+    { "\\", builtin_lambda, lspecial_lambda },
+    { "def", builtin_def, lspecial_def },
+    { "=", builtin_put, lspecial_put },
+};
+
+/* Mark the symbols naming special forms */
+void lspecial_init(void) {
+    int n = sizeof(lspecials) / sizeof(lspecials[0]);
+    for (int i = 0; i < n; i++) { lsym_intern(lspecials[i].name)->form = i + 1; }
+}
+
+/* Find the special form a head symbol names in "e", or NULL */
+lspecial lspecial_find(lenv* e, lval* k) {
+    int i = LSYMID(k)->form - 1;
+    if (i < 0) { return NULL; }
+    
+    /* Only while the name is still bound to the builtin */
+    lval* f = lenv_get(e, k);
+    int ok = LTYPE(f) == LVAL_FUN && LBUILTIN(f) == lspecials[i].func;
     lval_del(f);
+    return ok ? lspecials[i].form : NULL;
+}
+
+/* Evaluate an Sexpr "lval" up to the call it ends in */
+/* The cells of the list "v", which may also be a Q-Expression, are only */
+/* read. The branch of if and the argument of eval are in tail */
+/* position, so they are evaluated by looping here rather than recursing, */
+/* with "hold" keeping whatever they were taken from alive. Gives the */
+/* value, or NULL with the function and the arguments of the call, "*n" */
+/* values in all, left on the value stack from "lvm_top" on. */
+lval* lval_eval_call(lenv* e, lval* v, int* argc) {
+    
+    if (lstack_full()) { return lval_err(LSTACK_ERR); }
+    
+    lval* hold = NULL;
+    lval* result;
+    
+    for (;;) {
+        
+        /* Special forms evaluate only what they need */
+        if (LCOUNT(v) > 0 && LVAL_IMM(LCELL(v)[0]) == LVAL_IMM_SYM) {
+            lspecial form = lspecial_find(e, LCELL(v)[0]);
+            lval* next = NULL;
+            result = form ? form(e, v, &next) : NULL;
+            if (result) { break; }
+            if (next) {
+                if (hold) { lval_del(hold); }
+                hold = v = next;
+                continue;
+            }
+        }
+        
+        /* Empty Expression */
+        int n = LCOUNT(v);
+        if (n == 0) { result = lval_sexpr(); break; }
+        
+        /* A single S-Expression is in tail position too */
+        if (n == 1 && LTYPE(LCELL(v)[0]) == LVAL_SEXPR) {
+            lval* next = lval_ref(LCELL(v)[0]);
+            if (hold) { lval_del(hold); }
+            hold = v = next;
+            continue;
+        }
+        
+        /* Evaluate Children onto the stack */
+        int base = lvm_top;
+        lvm_reserve(base + n);
+        for (int i = 0; i < n; i++) {
+            lval* x = lval_eval(e, LCELL(v)[i]);
+            lvm_stack[lvm_top++] = x;
+        }
+        lval** args = lvm_stack + base;
+        lvm_top = base;
+        
+        /* Single Expression */
+        if (n == 1) { result = args[0]; break; }
+        
+        /* Error Checking, and that the First Element is a Function */
+        result = lvm_check(args, n - 1);
+        if (result) { break; }
+        lval* f = args[0];
+        
+        /* Continue with the chosen branch of any well formed if */
+        if (LBUILTIN(f) == builtin_if && n == 4 &&
+                LTYPE(args[1]) == LVAL_NUM &&
+                LTYPE(args[2]) == LVAL_QEXPR &&
+                LTYPE(args[3]) == LVAL_QEXPR) {
+            lval* next = args[LNUM(args[1]) ? 2 : 3];
+            lval_del(args[LNUM(args[1]) ? 3 : 2]);
+            lval_del(args[1]);
+            lval_del(f);
+            if (hold) { lval_del(hold); }
+            hold = v = next;
+            continue;
+        }
+        
+        /* Continue with the expression given to eval */
+        if (LBUILTIN(f) == builtin_eval && n == 2 &&
+                LTYPE(args[1]) == LVAL_QEXPR) {
+            lval* next = args[1];
+            lval_del(f);
+            if (hold) { lval_del(hold); }
+            hold = v = next;
+            continue;
+        }
+        
+        /* What was evaluated is all on the stack */
+        *argc = n;
+        result = NULL;
+        break;
+    }
+    
+    if (hold) { lval_del(hold); }
+    return result;
+}
+
+/* Eval an Sexpr "lval" */
+/* The values of the call go on the value stack of the virtual machine */
+/* and are lent from there to the call */
+lval* lval_eval_sexpr(lenv* e, lval* v) {
+    int n;
+    lval* result = lval_eval_call(e, v, &n);
+    if (result) { return result; }
+    
+    /* Call with the arguments lent from the stack until it returns */
+    int base = lvm_top;
+    lvm_top = base + n;
+    result = lval_call(e, lvm_stack[base], n - 1, lvm_stack + base + 1);
+    lvm_del(lvm_stack + base, n);
+    lvm_top = base;
     return result;
 }
 
 /* Eval an "lval" */
+/* The code in "v" is only read, the value is a new reference */
 lval* lval_eval(lenv* e, lval* v) {
-    if (v->type == LVAL_SYM) {
-        lval* x = lenv_get(e, v);
-        lval_del(v);
-        return x;
-    }
+    if (LTYPE(v) == LVAL_SYM) { return lenv_get(e, v); }
     /* Evaluate S-expressions */
-    if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
+    if (LTYPE(v) == LVAL_SEXPR) { return lval_eval_sexpr(e, v); }
     /* All other lval types remain the same */
-    return v;
+    return lval_ref(v);
 }
 
 int main(int argc, char** argv) {
-        
+    
+    lstack_init(&argc);
+    
+#ifdef LISPY_MPC_READER
     /* Construct Some Parsers */
     Number   = mpc_new("number");
     Dnumber  = mpc_new("double");
@@ -1389,31 +6611,106 @@ int main(int argc, char** argv) {
             lispy   : /^/ <expr>* /$/ ;                         \
         ",
         Number, Dnumber, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+#endif
+    
+    lsym_amp = lsym_intern("&");
+    lspecial_init();
+    lsimd_init();
+    
+#ifdef LPAR
+    /* Read with a thread for each CPU */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    lpar_threads = cpus < 1 ? 1 : cpus > LPAR_MAX ? LPAR_MAX : cpus;
+#endif
+    
+    /* Options come before the files: "--parse-threads N" sets the */
+    /* threads reading files, "--time" reports where the time went and */
+    /* "--no-cache" leaves caches of files' forms unread and unwritten */
+    int first = 1;
+    while (first < argc) {
+        if (strcmp(argv[first], "--parse-threads") == 0 && first + 1 < argc) {
+#ifdef LPAR
+            int n = atoi(argv[first + 1]);
+            lpar_threads = n < 1 ? 1 : n;
+#endif
+            first += 2;
+        } else if (strcmp(argv[first], "--time") == 0) {
+            ltime_on = 1;
+            first++;
+        } else if (strcmp(argv[first], "--no-cache") == 0) {
+            lcache_on = 0;
+            first++;
+        } else {
+            break;
+        }
+    }
     
     lenv* e = lenv_new();
+    lenv_root = e;
     lenv_add_builtins(e);
     
     /* Supplied with list of files */
-    if (argc >= 2) {
+    if (first < argc) {
+        double start = ltime_clock();
+#ifdef LPAR
+        /* Files are read ahead on other threads, but run in order */
+        lahead* ahead = lpar_ahead(argv + first, argc - first);
+#endif
         
-        /* loop over each supplied filename (starting from 1) */
-        for (int i = 1; i < argc; i++) {
+        /* loop over each supplied filename */
+        for (int i = first; i < argc; i++) {
+            double read = ltime_read, eval = ltime_eval, t = ltime_clock();
             
-            /* Argument list with a single argument, the filename */
-            lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
-            
-            /* Pass to builtin load and get the result */
-            lval* x = builtin_load(e, args);
+            /* "-" runs the lines of stdin as they come in */
+            lval* x = NULL;
+            if (strcmp(argv[i], "-") == 0) {
+                x = lval_load(e, "<stdin>", stdin, 1);
+            } else {
+#ifdef LPAR
+                if (ahead[i - first].buf) {
+                    x = lpar_run(e, argv[i], &ahead[i - first]);
+                }
+#endif
+                if (!x) {
+                    /* A single argument, the filename */
+                    lval* file = lval_str(argv[i]);
+                    
+                    /* Pass to builtin load and get the result */
+                    x = builtin_load(e, 1, &file);
+                    lval_del(file);
+                }
+            }
             
             /* If the result is an error be sure to print it */
-            if (x->type == LVAL_ERR) { lval_println(x); }
+            if (LTYPE(x) == LVAL_ERR) { lval_println(x); }
             lval_del(x);
+            
+            if (ltime_on) {
+                fflush(stdout);
+                fprintf(stderr, "%s: read %.3fs, eval %.3fs, %.3fs in all\n",
+                        argv[i], ltime_read - read, ltime_eval - eval,
+                        ltime_clock() - t);
+            }
+        }
+        
+        if (ltime_on) {
+#ifdef LPAR
+            int threads = lpar_threads;
+#else
+            int threads = 1;
+#endif
+            fprintf(stderr, "total: read %.3fs on %i thread%s, eval %.3fs, "
+                    "%.3fs in all\n", ltime_read, threads,
+                    threads == 1 ? "" : "s", ltime_eval, ltime_clock() - start);
         }
+#ifdef LPAR
+        free(ahead);
+#endif
         return 0;
     }
     
     /* Print Version and Exit Information */
-    puts("Lispy Version 0.0.0.1.2");
+    puts("Lispy Version " LISPY_VERSION);
     puts("Type quit 0 to Exit\n");
     
     /* In a never ending loop */
@@ -1426,20 +6723,19 @@ int main(int argc, char** argv) {
         /* Add input to history */
         add_history(input);
         
-        /* Attempt to Parse the user Input */
-        mpc_result_t r;
-        if (mpc_parse("<stdin>", input, Lispy, &r)) {
-            /* On Success eval the AST */
-            lval* result = lval_read(r.output);
-            result = lval_eval(e, result);
+        /* Attempt to Read the user Input */
+        char* err;
+        lval* expr = lread_all("<stdin>", input, strlen(input), &err);
+        if (expr) {
+            /* On Success eval it */
+            lval* result = lval_eval(e, expr);
             lval_println(result);
             lval_del(result);
-            
-            mpc_ast_delete(r.output);
+            lval_del(expr);
         } else {
             /* Otherwise Print the Error */
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
+            printf("%s", err);
+            free(err);
         }
         
         /* Free retrieved input */
@@ -1449,7 +6745,9 @@ int main(int argc, char** argv) {
     
     /* Undefine and Delete our Parsers */
     lenv_del(e);
+#ifdef LISPY_MPC_READER
     mpc_cleanup(9, Number, Dnumber, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+#endif
     
     return 0;
 }